@@ -69,16 +69,20 @@ int create;
     arr->type = type;
     arr->ndims = 1;
     arr->dims[0] = 11;  /* 0-10 = 11 elements */
+    arr->stride[0] = 1;
     arr->size = 11;
 
     if (type == TYPE_STR) {
         arr->data.strdata = (string_t **)calloc(arr->size, sizeof(string_t *));
+    } else if (type == TYPE_INT) {
+        arr->data.intdata = (short *)calloc(arr->size, sizeof(short));
     } else {
         arr->data.numdata = (double *)calloc(arr->size, sizeof(double));
     }
 
     if ((type == TYPE_STR && !arr->data.strdata) ||
-        (type != TYPE_STR && !arr->data.numdata)) {
+        (type == TYPE_INT && !arr->data.intdata) ||
+        (type == TYPE_NUM && !arr->data.numdata)) {
         free(arr);
         error(ERR_OUT_OF_MEM);
         return NULL;
@@ -133,12 +137,6 @@ int type;
         }
     }
 
-    /* Calculate total size */
-    size = 1;
-    for (i = 0; i < ndims; i++) {
-        size *= dims[i];
-    }
-
     /* Allocate array */
     arr = (array_t *)malloc(sizeof(array_t));
     if (!arr) {
@@ -149,11 +147,15 @@ int type;
     strcpy(arr->name, normname);
     arr->type = type;
     arr->ndims = ndims;
-    arr->size = size;
 
-    for (i = 0; i < ndims; i++) {
+    /* Last index varies fastest */
+    size = 1;
+    for (i = ndims - 1; i >= 0; i--) {
         arr->dims[i] = dims[i];
+        arr->stride[i] = size;
+        size *= dims[i];
     }
+    arr->size = size;
 
     if (type == TYPE_STR) {
         arr->data.strdata = (string_t **)calloc(size, sizeof(string_t *));
@@ -162,6 +164,13 @@ int type;
             error(ERR_OUT_OF_MEM);
             return;
         }
+    } else if (type == TYPE_INT) {
+        arr->data.intdata = (short *)calloc(size, sizeof(short));
+        if (!arr->data.intdata) {
+            free(arr);
+            error(ERR_OUT_OF_MEM);
+            return;
+        }
     } else {
         arr->data.numdata = (double *)calloc(size, sizeof(double));
         if (!arr->data.numdata) {
@@ -177,87 +186,182 @@ int type;
 }
 
 /*
- * Get pointer to numeric array element
+ * Find the array for a variable slot - the result is remembered in
+ * aryslot until the arrays are cleared
  */
-double *
-array_num_element(name, indices, nindices)
-const char *name;
-int *indices;
-int nindices;
+array_t *
+slot_array(slot, create)
+int slot;
+int create;
 {
     array_t *arr;
-    int offset, i, mult;
+    char name[NAMLEN+3];
 
-    arr = find_array(name, 1);
-    if (!arr) {
-        return NULL;
+    arr = g_state->aryslot[slot];
+    if (arr) {
+        return arr;
     }
 
-    if (arr->type == TYPE_STR) {
-        error(ERR_TYPE_MISM);
-        return NULL;
-    }
+    slot_name(slot, name);
+    arr = find_array(name, create);
+    g_state->aryslot[slot] = arr;
+    return arr;
+}
+
+/*
+ * Offset of an element, or -1 after a subscript error
+ * One and two dimensions, nearly every array in practice, take a single
+ * branch; the unsigned compares reject negative indices as well.
+ */
+static int
+element_offset(arr, indices, nindices)
+array_t *arr;
+int *indices;
+int nindices;
+{
+    int offset, i;
 
     if (nindices != arr->ndims) {
         error(ERR_SUBSCRIPT);
+        return -1;
+    }
+
+    switch (nindices) {
+        case 1:
+            if ((unsigned)indices[0] < (unsigned)arr->dims[0]) {
+                return indices[0];
+            }
+            break;
+
+        case 2:
+            if (((unsigned)indices[0] < (unsigned)arr->dims[0]) &
+                ((unsigned)indices[1] < (unsigned)arr->dims[1])) {
+                return indices[0] * arr->stride[0] + indices[1];
+            }
+            break;
+
+        default:
+            offset = 0;
+            for (i = 0; i < nindices; i++) {
+                if ((unsigned)indices[i] >= (unsigned)arr->dims[i]) {
+                    error(ERR_SUBSCRIPT);
+                    return -1;
+                }
+                offset += indices[i] * arr->stride[i];
+            }
+            return offset;
+    }
+
+    error(ERR_SUBSCRIPT);
+    return -1;
+}
+
+/*
+ * Get pointer to numeric element of an array
+ */
+double *
+array_num_at(arr, indices, nindices)
+array_t *arr;
+int *indices;
+int nindices;
+{
+    int offset;
+
+    if (arr->type != TYPE_NUM) {
+        error(ERR_TYPE_MISM);
         return NULL;
     }
 
-    /* Calculate offset */
-    offset = 0;
-    mult = 1;
-    for (i = arr->ndims - 1; i >= 0; i--) {
-        if (indices[i] < 0 || indices[i] >= arr->dims[i]) {
-            error(ERR_SUBSCRIPT);
-            return NULL;
-        }
-        offset += indices[i] * mult;
-        mult *= arr->dims[i];
+    offset = element_offset(arr, indices, nindices);
+    if (offset < 0) {
+        return NULL;
     }
 
     return &arr->data.numdata[offset];
 }
 
 /*
- * Get pointer to string array element
+ * Get pointer to integer element of an array
  */
-string_t **
-array_str_element(name, indices, nindices)
-const char *name;
+short *
+array_int_at(arr, indices, nindices)
+array_t *arr;
 int *indices;
 int nindices;
 {
-    array_t *arr;
-    int offset, i, mult;
+    int offset;
 
-    arr = find_array(name, 1);
-    if (!arr) {
+    if (arr->type != TYPE_INT) {
+        error(ERR_TYPE_MISM);
         return NULL;
     }
 
+    offset = element_offset(arr, indices, nindices);
+    if (offset < 0) {
+        return NULL;
+    }
+
+    return &arr->data.intdata[offset];
+}
+
+/*
+ * Get pointer to string element of an array
+ */
+string_t **
+array_str_at(arr, indices, nindices)
+array_t *arr;
+int *indices;
+int nindices;
+{
+    int offset;
+
     if (arr->type != TYPE_STR) {
         error(ERR_TYPE_MISM);
         return NULL;
     }
 
-    if (nindices != arr->ndims) {
-        error(ERR_SUBSCRIPT);
+    offset = element_offset(arr, indices, nindices);
+    if (offset < 0) {
         return NULL;
     }
 
-    /* Calculate offset */
-    offset = 0;
-    mult = 1;
-    for (i = arr->ndims - 1; i >= 0; i--) {
-        if (indices[i] < 0 || indices[i] >= arr->dims[i]) {
-            error(ERR_SUBSCRIPT);
-            return NULL;
-        }
-        offset += indices[i] * mult;
-        mult *= arr->dims[i];
+    return &arr->data.strdata[offset];
+}
+
+/*
+ * Get pointer to numeric array element
+ */
+double *
+array_num_element(name, indices, nindices)
+const char *name;
+int *indices;
+int nindices;
+{
+    array_t *arr;
+
+    arr = find_array(name, 1);
+    if (!arr) {
+        return NULL;
     }
+    return array_num_at(arr, indices, nindices);
+}
 
-    return &arr->data.strdata[offset];
+/*
+ * Get pointer to string array element
+ */
+string_t **
+array_str_element(name, indices, nindices)
+const char *name;
+int *indices;
+int nindices;
+{
+    array_t *arr;
+
+    arr = find_array(name, 1);
+    if (!arr) {
+        return NULL;
+    }
+    return array_str_at(arr, indices, nindices);
 }
 
 /*
@@ -281,7 +385,9 @@ clear_arrays()
                 }
             }
             free(arr->data.strdata);
-        } else if (arr->data.numdata) {
+        } else if (arr->type == TYPE_INT && arr->data.intdata) {
+            free(arr->data.intdata);
+        } else if (arr->type == TYPE_NUM && arr->data.numdata) {
             free(arr->data.numdata);
         }
 
@@ -290,4 +396,5 @@ clear_arrays()
     }
 
     g_state->arrlist = NULL;
+    memset(g_state->aryslot, 0, sizeof(g_state->aryslot));
 }
@@ -11,15 +11,10 @@
 static int valtype;
 
 /* Forward declarations */
-static double expr_or();
-static double expr_and();
-static double expr_not();
-static double expr_compare();
-static double expr_add();
-static double expr_mult();
-static double expr_power();
+static double expr_binary();
 static double expr_unary();
 static double expr_primary();
+static string_t *str_primary();
 
 /*
  * Get next character from text pointer
@@ -88,34 +83,13 @@ get_valtype()
 /*
  * Parse a number from text
  */
-static double
+double
 parse_number()
 {
-    char buf[32];
-    int i;
+    double num;
 
-    i = 0;
-    while (IS_DIGIT(peek_char()) || peek_char() == '.' ||
-           peek_char() == 'E' || peek_char() == 'e' ||
-           peek_char() == '+' || peek_char() == '-') {
-        if (i < 31) {
-            buf[i++] = get_next_char();
-        } else {
-            get_next_char();
-        }
-        /* Handle E+/E- specially */
-        if (i >= 2 && (buf[i-2] == 'E' || buf[i-2] == 'e')) {
-            /* This is part of exponent, continue */
-        } else if (buf[i-1] == '+' || buf[i-1] == '-') {
-            /* Not after E, put it back */
-            i--;
-            g_state->txtptr--;
-            break;
-        }
-    }
-    buf[i] = '\0';
-
-    return atof(buf);
+    g_state->txtptr += scan_number((char *)g_state->txtptr, -1, &num);
+    return num;
 }
 
 /*
@@ -128,7 +102,7 @@ parse_string_literal()
     int i;
 
     if (peek_char() != '"') {
-        return alloc_string(0);
+        return temp_string(0);
     }
     get_next_char();  /* Skip opening quote */
 
@@ -146,44 +120,53 @@ parse_string_literal()
         get_next_char();  /* Skip closing quote */
     }
 
-    return string_from_cstr(buf);
+    return temp_cstr(buf);
 }
 
 /*
- * Parse variable name
+ * Read a variable reference token - returns the variable's slot
  */
-static void
-parse_varname(name, type)
-char *name;
-int *type;
+int
+get_varref()
 {
-    int i;
-    char c;
+    unsigned char *p;
 
-    i = 0;
-    *type = TYPE_NUM;
+    p = g_state->txtptr;
+    g_state->txtptr = p + 4 + (p[3] & 0x7F);
+    return ((p[1] & 0x3F) << 6) | (p[2] & 0x3F);
+}
 
-    /* Get name characters (max 2 for 6502 BASIC) */
-    while (IS_ALNUM(peek_char()) && i < NAMLEN) {
-        c = get_next_char();
-        if (c >= 'a' && c <= 'z') {
-            name[i++] = c - 'a' + 'A';
-        } else {
-            name[i++] = c;
+/*
+ * Read a numeric literal or folded constant token - returns the value
+ * converted when the line was stored
+ */
+double
+get_numlit()
+{
+    union {
+        double d;
+        unsigned char b[sizeof(double)];
+    } u;
+    unsigned char *p;
+    unsigned int acc;
+    int bits, i;
+
+    p = g_state->txtptr + 1;
+    acc = 0;
+    bits = 0;
+    i = 0;
+    while (i < (int)sizeof(double)) {
+        acc = (acc << 7) | (*p++ & 0x7F);
+        bits += 7;
+        if (bits >= 8) {
+            bits -= 8;
+            u.b[i++] = (acc >> bits) & 0xFF;
+            acc &= (1 << bits) - 1;
         }
     }
 
-    /* Check for type suffix */
-    if (peek_char() == '$') {
-        get_next_char();
-        *type = TYPE_STR;
-        name[i++] = '$';
-    } else if (peek_char() == '%') {
-        get_next_char();
-        *type = TYPE_INT;
-    }
-
-    name[i] = '\0';
+    g_state->txtptr = skip_token(g_state->txtptr);
+    return u.d;
 }
 
 /*
@@ -194,18 +177,22 @@ expr_primary()
 {
     double result;
     int c, token;
-    char varname[NAMLEN+3];
-    int type;
+    int slot;
     var_t *var;
     int indices[11];
     int nindices;
     double *numelem;
+    short *intelem;
     string_t *s;
 
     skip_spaces();
     c = peek_char();
 
     /* Number */
+    if ((c & 0xFF) == TOK_NUM || (c & 0xFF) == TOK_FOLD) {
+        valtype = TYPE_NUM;
+        return get_numlit();
+    }
     if (IS_DIGIT(c) || (c == '.' && IS_DIGIT(g_state->txtptr[1]))) {
         valtype = TYPE_NUM;
         return parse_number();
@@ -221,7 +208,7 @@ expr_primary()
     /* Parenthesized expression */
     if (c == '(') {
         get_next_char();
-        result = expr_or();
+        result = expr_binary(PREC_OR);
         skip_spaces();
         if (peek_char() == ')') {
             get_next_char();
@@ -229,6 +216,54 @@ expr_primary()
         return result;
     }
 
+    /* Variable or array */
+    if (c == TOK_VAR) {
+        slot = get_varref();
+
+        if (SLOT_TYPE(slot) == TYPE_STR) {
+            valtype = TYPE_STR;
+            return 0.0;  /* String handling done separately */
+        }
+
+        valtype = TYPE_NUM;
+
+        /* Check for array subscript */
+        skip_spaces();
+        if (peek_char() == '(') {
+            get_next_char();
+            nindices = 0;
+
+            while (nindices < 11) {
+                indices[nindices++] = (int)expr_binary(PREC_OR);
+                skip_spaces();
+                if (peek_char() == ',') {
+                    get_next_char();
+                } else {
+                    break;
+                }
+            }
+
+            skip_spaces();
+            if (peek_char() == ')') {
+                get_next_char();
+            }
+
+            if (SLOT_TYPE(slot) == TYPE_INT) {
+                intelem = array_int_at(slot_array(slot, 1), indices, nindices);
+                return intelem ? (double)*intelem : 0.0;
+            }
+            numelem = array_num_at(slot_array(slot, 1), indices, nindices);
+            return numelem ? *numelem : 0.0;
+        }
+
+        /* Simple variable */
+        var = g_state->varslot[slot];
+        if (var) {
+            return var_num(var);
+        }
+        return 0.0;
+    }
+
     /* Token-based functions */
     token = c & 0xFF;
     if (token >= 128) {
@@ -238,7 +273,7 @@ expr_primary()
             case TOK_SGN:
                 skip_spaces();
                 if (peek_char() == '(') get_next_char();
-                result = fn_sgn(expr_or());
+                result = fn_sgn(expr_binary(PREC_OR));
                 skip_spaces();
                 if (peek_char() == ')') get_next_char();
                 return result;
@@ -246,7 +281,7 @@ expr_primary()
             case TOK_INT:
                 skip_spaces();
                 if (peek_char() == '(') get_next_char();
-                result = fn_int(expr_or());
+                result = fn_int(expr_binary(PREC_OR));
                 skip_spaces();
                 if (peek_char() == ')') get_next_char();
                 return result;
@@ -254,7 +289,7 @@ expr_primary()
             case TOK_ABS:
                 skip_spaces();
                 if (peek_char() == '(') get_next_char();
-                result = fn_abs(expr_or());
+                result = fn_abs(expr_binary(PREC_OR));
                 skip_spaces();
                 if (peek_char() == ')') get_next_char();
                 return result;
@@ -262,7 +297,7 @@ expr_primary()
             case TOK_SQR:
                 skip_spaces();
                 if (peek_char() == '(') get_next_char();
-                result = fn_sqr(expr_or());
+                result = fn_sqr(expr_binary(PREC_OR));
                 skip_spaces();
                 if (peek_char() == ')') get_next_char();
                 return result;
@@ -270,7 +305,7 @@ expr_primary()
             case TOK_RND:
                 skip_spaces();
                 if (peek_char() == '(') get_next_char();
-                result = fn_rnd(expr_or());
+                result = fn_rnd(expr_binary(PREC_OR));
                 skip_spaces();
                 if (peek_char() == ')') get_next_char();
                 return result;
@@ -278,7 +313,7 @@ expr_primary()
             case TOK_SIN:
                 skip_spaces();
                 if (peek_char() == '(') get_next_char();
-                result = fn_sin(expr_or());
+                result = fn_sin(expr_binary(PREC_OR));
                 skip_spaces();
                 if (peek_char() == ')') get_next_char();
                 return result;
@@ -286,7 +321,7 @@ expr_primary()
             case TOK_COS:
                 skip_spaces();
                 if (peek_char() == '(') get_next_char();
-                result = fn_cos(expr_or());
+                result = fn_cos(expr_binary(PREC_OR));
                 skip_spaces();
                 if (peek_char() == ')') get_next_char();
                 return result;
@@ -294,7 +329,7 @@ expr_primary()
             case TOK_TAN:
                 skip_spaces();
                 if (peek_char() == '(') get_next_char();
-                result = fn_tan(expr_or());
+                result = fn_tan(expr_binary(PREC_OR));
                 skip_spaces();
                 if (peek_char() == ')') get_next_char();
                 return result;
@@ -302,7 +337,7 @@ expr_primary()
             case TOK_ATN:
                 skip_spaces();
                 if (peek_char() == '(') get_next_char();
-                result = fn_atn(expr_or());
+                result = fn_atn(expr_binary(PREC_OR));
                 skip_spaces();
                 if (peek_char() == ')') get_next_char();
                 return result;
@@ -310,7 +345,7 @@ expr_primary()
             case TOK_LOG:
                 skip_spaces();
                 if (peek_char() == '(') get_next_char();
-                result = fn_log(expr_or());
+                result = fn_log(expr_binary(PREC_OR));
                 skip_spaces();
                 if (peek_char() == ')') get_next_char();
                 return result;
@@ -318,7 +353,7 @@ expr_primary()
             case TOK_EXP:
                 skip_spaces();
                 if (peek_char() == '(') get_next_char();
-                result = fn_exp(expr_or());
+                result = fn_exp(expr_binary(PREC_OR));
                 skip_spaces();
                 if (peek_char() == ')') get_next_char();
                 return result;
@@ -326,7 +361,7 @@ expr_primary()
             case TOK_PEEK:
                 skip_spaces();
                 if (peek_char() == '(') get_next_char();
-                result = fn_peek(expr_or());
+                result = fn_peek(expr_binary(PREC_OR));
                 skip_spaces();
                 if (peek_char() == ')') get_next_char();
                 return result;
@@ -334,7 +369,7 @@ expr_primary()
             case TOK_FRE:
                 skip_spaces();
                 if (peek_char() == '(') get_next_char();
-                result = fn_fre(expr_or());
+                result = fn_fre(expr_binary(PREC_OR));
                 skip_spaces();
                 if (peek_char() == ')') get_next_char();
                 return result;
@@ -342,7 +377,7 @@ expr_primary()
             case TOK_POS:
                 skip_spaces();
                 if (peek_char() == '(') get_next_char();
-                result = fn_pos(expr_or());
+                result = fn_pos(expr_binary(PREC_OR));
                 skip_spaces();
                 if (peek_char() == ')') get_next_char();
                 return result;
@@ -354,7 +389,6 @@ expr_primary()
                 skip_spaces();
                 if (peek_char() == ')') get_next_char();
                 result = (double)fn_len(s);
-                if (s) free_string(s);
                 return result;
 
             case TOK_ASC:
@@ -364,7 +398,6 @@ expr_primary()
                 skip_spaces();
                 if (peek_char() == ')') get_next_char();
                 result = (double)fn_asc(s);
-                if (s) free_string(s);
                 return result;
 
             case TOK_VAL:
@@ -374,7 +407,6 @@ expr_primary()
                 skip_spaces();
                 if (peek_char() == ')') get_next_char();
                 result = fn_val(s);
-                if (s) free_string(s);
                 return result;
 
             default:
@@ -384,52 +416,109 @@ expr_primary()
         }
     }
 
-    /* Variable or array */
-    if (IS_ALPHA(c)) {
-        parse_varname(varname, &type);
-
-        if (type == TYPE_STR) {
-            valtype = TYPE_STR;
-            return 0.0;  /* String handling done separately */
-        }
-
-        valtype = TYPE_NUM;
+    valtype = TYPE_NUM;
+    return 0.0;
+}
 
-        /* Check for array subscript */
-        skip_spaces();
-        if (peek_char() == '(') {
-            get_next_char();
-            nindices = 0;
+/*
+ * Binary operators, in both their ASCII and token forms.  Relations
+ * carry the code of their first character; scan_binop() works out the
+ * two-character ones.
+ */
+static struct {
+    int c;              /* Character or token */
+    int prec;           /* Precedence level */
+    int op;             /* Operator it stands for */
+} binops[] = {
+    { TOK_OR,    PREC_OR,      TOK_OR },
+    { TOK_AND,   PREC_AND,     TOK_AND },
+    { '<',       PREC_COMPARE, 1 },
+    { TOK_LT,    PREC_COMPARE, 1 },
+    { '>',       PREC_COMPARE, 2 },
+    { TOK_GT,    PREC_COMPARE, 2 },
+    { '=',       PREC_COMPARE, 6 },
+    { TOK_EQ,    PREC_COMPARE, 6 },
+    { '+',       PREC_ADD,     '+' },
+    { TOK_PLUS,  PREC_ADD,     '+' },
+    { '-',       PREC_ADD,     '-' },
+    { TOK_MINUS, PREC_ADD,     '-' },
+    { '*',       PREC_MULT,    '*' },
+    { TOK_MULT,  PREC_MULT,    '*' },
+    { '/',       PREC_MULT,    '/' },
+    { TOK_DIV,   PREC_MULT,    '/' },
+    { '^',       PREC_POWER,   '^' },
+    { TOK_POWER, PREC_POWER,   '^' }
+};
+
+/* binops index + 1 for each character, 0 if it is not an operator */
+static unsigned char binop_index[256];
 
-            while (nindices < 11) {
-                indices[nindices++] = (int)expr_or();
-                skip_spaces();
-                if (peek_char() == ',') {
-                    get_next_char();
-                } else {
-                    break;
-                }
-            }
+/*
+ * Build the operator lookup
+ */
+void
+eval_init()
+{
+    int i;
 
-            skip_spaces();
-            if (peek_char() == ')') {
-                get_next_char();
-            }
+    for (i = 0; i < (int)(sizeof(binops) / sizeof(binops[0])); i++) {
+        binop_index[binops[i].c & 0xFF] = (unsigned char)(i + 1);
+    }
+}
 
-            numelem = array_num_element(varname, indices, nindices);
-            return numelem ? *numelem : 0.0;
-        }
+/*
+ * Recognize a binary operator at p
+ * Returns its length, 0 if there is none, with its precedence and
+ * operator.  Relations come back as codes 1-6: < > <= >= <> =.
+ */
+int
+scan_binop(p, prec, op)
+const unsigned char *p;
+int *prec;
+int *op;
+{
+    int i, n, c;
 
-        /* Simple variable */
-        var = find_variable(varname, 0);
-        if (var) {
-            return var->value.numval;
-        }
-        return 0.0;
+    i = binop_index[*p];
+    if (i == 0) {
+        return 0;
+    }
+    i--;
+    *prec = binops[i].prec;
+    *op = binops[i].op;
+    if (*prec != PREC_COMPARE) {
+        return 1;
     }
 
-    valtype = TYPE_NUM;
-    return 0.0;
+    /* Second character of a relation, blanks allowed between as in
+       skip_spaces() */
+    n = 1;
+    while (p[n] == ' ' || p[n] == '\t') {
+        n++;
+    }
+    c = binop_index[p[n]];
+    if (c == 0 || binops[c - 1].prec != PREC_COMPARE) {
+        return 1;
+    }
+    c = binops[c - 1].op;
+    switch (*op) {
+        case 1:
+            if (c == 2) *op = 5;
+            else if (c == 6) *op = 3;
+            else return 1;
+            break;
+        case 2:
+            if (c == 6) *op = 4;
+            else if (c == 1) *op = 5;
+            else return 1;
+            break;
+        default:
+            if (c == 1) *op = 3;
+            else if (c == 2) *op = 4;
+            else return 1;
+            break;
+    }
+    return n + 1;
 }
 
 /*
@@ -462,211 +551,60 @@ expr_unary()
 }
 
 /*
- * Power operator (^)
+ * Binary operators binding at least as tightly as minprec
+ * All operators are left associative.  A relation is only taken
+ * straight after an arithmetic operand, so they do not chain and do
+ * not follow AND or OR without a new operand.
  */
 static double
-expr_power()
+expr_binary(minprec)
+int minprec;
 {
     double left, right;
+    int prec, op, n;
+    int logical;
 
     left = expr_unary();
-
-    skip_spaces();
-    while (peek_char() == '^' || (peek_char() & 0xFF) == TOK_POWER) {
-        get_next_char();
-        right = expr_unary();
-        left = pow(left, right);
-        skip_spaces();
-    }
-
-    return left;
-}
-
-/*
- * Multiplication and division
- */
-static double
-expr_mult()
-{
-    double left, right;
-    int op;
-
-    left = expr_power();
+    logical = 0;
 
     while (1) {
         skip_spaces();
-        op = peek_char();
-
-        if (op == '*' || (op & 0xFF) == TOK_MULT) {
-            get_next_char();
-            right = expr_power();
-            left = left * right;
-        } else if (op == '/' || (op & 0xFF) == TOK_DIV) {
-            get_next_char();
-            right = expr_power();
-            if (right == 0.0) {
-                error(ERR_DIV_ZERO);
-                return 0.0;
-            }
-            left = left / right;
-        } else {
+        n = scan_binop(g_state->txtptr, &prec, &op);
+        if (n == 0 || prec < minprec ||
+            (prec == PREC_COMPARE && logical)) {
             break;
         }
-    }
-
-    return left;
-}
-
-/*
- * Addition and subtraction
- */
-static double
-expr_add()
-{
-    double left, right;
-    int op;
-
-    left = expr_mult();
-
-    while (1) {
-        skip_spaces();
-        op = peek_char();
-
-        if (op == '+' || (op & 0xFF) == TOK_PLUS) {
-            get_next_char();
-            right = expr_mult();
-            left = left + right;
-        } else if (op == '-' || (op & 0xFF) == TOK_MINUS) {
-            get_next_char();
-            right = expr_mult();
-            left = left - right;
-        } else {
-            break;
-        }
-    }
-
-    return left;
-}
-
-/*
- * Comparison operators
- */
-static double
-expr_compare()
-{
-    double left, right;
-    int op1, op2;
-    int relation;
-
-    left = expr_add();
-
-    skip_spaces();
-    op1 = peek_char();
-
-    if (op1 == '<' || op1 == '>' || op1 == '=' ||
-        (op1 & 0xFF) == TOK_LT || (op1 & 0xFF) == TOK_GT || (op1 & 0xFF) == TOK_EQ) {
-
-        get_next_char();
-        skip_spaces();
-        op2 = peek_char();
-
-        /* Check for compound operators */
-        relation = 0;
-        if (op1 == '<' || (op1 & 0xFF) == TOK_LT) {
-            relation = 1;  /* Less than */
-            if (op2 == '>' || (op2 & 0xFF) == TOK_GT) {
-                get_next_char();
-                relation = 5;  /* Not equal */
-            } else if (op2 == '=' || (op2 & 0xFF) == TOK_EQ) {
-                get_next_char();
-                relation = 3;  /* Less or equal */
-            }
-        } else if (op1 == '>' || (op1 & 0xFF) == TOK_GT) {
-            relation = 2;  /* Greater than */
-            if (op2 == '=' || (op2 & 0xFF) == TOK_EQ) {
-                get_next_char();
-                relation = 4;  /* Greater or equal */
-            } else if (op2 == '<' || (op2 & 0xFF) == TOK_LT) {
-                get_next_char();
-                relation = 5;  /* Not equal */
-            }
-        } else if (op1 == '=' || (op1 & 0xFF) == TOK_EQ) {
-            relation = 6;  /* Equal */
-            if (op2 == '<' || (op2 & 0xFF) == TOK_LT) {
-                get_next_char();
-                relation = 3;  /* Less or equal */
-            } else if (op2 == '>' || (op2 & 0xFF) == TOK_GT) {
-                get_next_char();
-                relation = 4;  /* Greater or equal */
-            }
-        }
-
-        right = expr_add();
-
-        switch (relation) {
-            case 1: return (left < right) ? -1.0 : 0.0;
-            case 2: return (left > right) ? -1.0 : 0.0;
-            case 3: return (left <= right) ? -1.0 : 0.0;
-            case 4: return (left >= right) ? -1.0 : 0.0;
-            case 5: return (left != right) ? -1.0 : 0.0;
-            case 6: return (left == right) ? -1.0 : 0.0;
-        }
-    }
-
-    return left;
-}
-
-/*
- * NOT operator (handled at comparison level)
- */
-static double
-expr_not()
-{
-    return expr_compare();
-}
-
-/*
- * AND operator
- */
-static double
-expr_and()
-{
-    double left, right;
-
-    left = expr_not();
-
-    while (1) {
-        skip_spaces();
-        if ((peek_char() & 0xFF) == TOK_AND) {
-            get_next_char();
-            right = expr_not();
-            left = (double)((long)left & (long)right);
-        } else {
-            break;
+        g_state->txtptr += n;
+        right = expr_binary(prec + 1);
+
+        switch (op) {
+            case '+': left = left + right; break;
+            case '-': left = left - right; break;
+            case '*': left = left * right; break;
+            case '/':
+                if (right == 0.0) {
+                    error(ERR_DIV_ZERO);
+                    return 0.0;
+                }
+                left = left / right;
+                break;
+            case '^': left = pow(left, right); break;
+            case TOK_AND:
+                left = (double)((long)left & (long)right);
+                break;
+            case TOK_OR:
+                left = (double)((long)left | (long)right);
+                break;
+            case 1: left = (left < right) ? -1.0 : 0.0; break;
+            case 2: left = (left > right) ? -1.0 : 0.0; break;
+            case 3: left = (left <= right) ? -1.0 : 0.0; break;
+            case 4: left = (left >= right) ? -1.0 : 0.0; break;
+            case 5: left = (left != right) ? -1.0 : 0.0; break;
+            case 6: left = (left == right) ? -1.0 : 0.0; break;
         }
-    }
-
-    return left;
-}
 
-/*
- * OR operator (top level)
- */
-static double
-expr_or()
-{
-    double left, right;
-
-    left = expr_and();
-
-    while (1) {
-        skip_spaces();
-        if ((peek_char() & 0xFF) == TOK_OR) {
-            get_next_char();
-            right = expr_and();
-            left = (double)((long)left | (long)right);
-        } else {
-            break;
+        if (prec <= PREC_COMPARE) {
+            logical = 1;
         }
     }
 
@@ -680,7 +618,7 @@ double
 eval_numeric()
 {
     valtype = TYPE_NUM;
-    return expr_or();
+    return expr_binary(PREC_OR);
 }
 
 /*
@@ -702,20 +640,47 @@ eval_integer()
 }
 
 /*
- * Evaluate string expression
+ * Evaluate string expression - operands joined by +
  */
 string_t *
 eval_string()
 {
-    char varname[NAMLEN+3];
-    int type;
+    string_t *s;
+    string_t *t;
+    int c;
+    int mark;
+
+    mark = temp_mark();
+    s = str_primary();
+
+    while (1) {
+        skip_spaces();
+        c = peek_char();
+        if (c != '+' && (c & 0xFF) != TOK_PLUS) {
+            break;
+        }
+        get_next_char();
+
+        t = str_primary();
+        s = temp_keep(mark, concat_strings(s, t));
+    }
+
+    return s;
+}
+
+/*
+ * Evaluate a single string operand
+ */
+static string_t *
+str_primary()
+{
+    int slot;
     var_t *var;
     int indices[11];
     int nindices;
     string_t **strelem;
     int token;
     string_t *s;
-    string_t *str_result;
     int n, start, len;
     double x;
 
@@ -726,6 +691,18 @@ eval_string()
         return parse_string_literal();
     }
 
+    /* Folded string constant */
+    if ((peek_char() & 0xFF) == TOK_FOLDSTR) {
+        n = g_state->txtptr[1] & 0x7F;
+        s = temp_string(n);
+        if (s && s->ptr) {
+            memcpy(s->ptr, g_state->txtptr + 2, n);
+            s->ptr[n] = '\0';
+        }
+        g_state->txtptr = skip_token(g_state->txtptr);
+        return s;
+    }
+
     /* String function tokens */
     if ((peek_char() & 0xFF) >= 128) {
         token = get_next_char() & 0xFF;
@@ -756,9 +733,7 @@ eval_string()
                 n = eval_integer();
                 skip_spaces();
                 if (peek_char() == ')') get_next_char();
-                str_result = fn_left(s, n);
-                if (s) free_string(s);
-                return str_result;
+                return fn_left(s, n);
 
             case TOK_RIGHT:
                 skip_spaces();
@@ -769,9 +744,7 @@ eval_string()
                 n = eval_integer();
                 skip_spaces();
                 if (peek_char() == ')') get_next_char();
-                str_result = fn_right(s, n);
-                if (s) free_string(s);
-                return str_result;
+                return fn_right(s, n);
 
             case TOK_MID:
                 skip_spaces();
@@ -788,9 +761,7 @@ eval_string()
                 }
                 skip_spaces();
                 if (peek_char() == ')') get_next_char();
-                str_result = fn_mid(s, start, len);
-                if (s) free_string(s);
-                return str_result;
+                return fn_mid(s, start, len);
 
             default:
                 /* Put back the token and continue */
@@ -799,11 +770,11 @@ eval_string()
         }
     }
 
-    /* String variable or function */
-    if (IS_ALPHA(peek_char())) {
-        parse_varname(varname, &type);
+    /* String variable or array */
+    if ((peek_char() & 0xFF) == TOK_VAR) {
+        slot = get_varref();
 
-        if (type != TYPE_STR) {
+        if (SLOT_TYPE(slot) != TYPE_STR) {
             error(ERR_TYPE_MISM);
             return NULL;
         }
@@ -829,22 +800,22 @@ eval_string()
                 get_next_char();
             }
 
-            strelem = array_str_element(varname, indices, nindices);
+            strelem = array_str_at(slot_array(slot, 1), indices, nindices);
             if (strelem && *strelem) {
-                return copy_string(*strelem);
+                return *strelem;
             }
-            return alloc_string(0);
+            return temp_string(0);
         }
 
         /* Simple string variable */
-        var = find_variable(varname, 0);
-        if (var && var->type == TYPE_STR && var->value.strval) {
-            return copy_string(var->value.strval);
+        var = g_state->varslot[slot];
+        if (var && var->value.strval) {
+            return var->value.strval;
         }
-        return alloc_string(0);
+        return temp_string(0);
     }
 
     /* String functions would be handled here */
 
-    return alloc_string(0);
+    return temp_string(0);
 }
@@ -7,15 +7,36 @@
 
 #include "m6502basic.h"
 
+/*
+ * Find the end of the line at txtptr - stored lines know where they
+ * end, anything else is scanned
+ */
+unsigned char *
+line_end()
+{
+    line_t *line;
+    unsigned char *p;
+
+    line = g_state->curline_ptr;
+    p = g_state->txtptr;
+    if (g_state->running && line && p >= line->text &&
+        p <= line->text + line->eol) {
+        return line->text + line->eol;
+    }
+
+    if (p) {
+        while (*p) p++;
+    }
+    return p;
+}
+
 /*
  * Skip to end of line
  */
 void
 skip_to_eol()
 {
-    while (peek_char() != '\0') {
-        get_next_char();
-    }
+    g_state->txtptr = line_end();
 }
 
 /*
@@ -26,6 +47,10 @@ execute_statement()
 {
     int token;
     int c;
+    char buf[32];
+
+    /* The last statement's string temporaries are finished with */
+    temp_release(0);
 
     skip_spaces();
 
@@ -45,8 +70,16 @@ execute_statement()
         return;
     }
 
+    /* Run the compiled form if the statement has one */
+    if (g_state->running && vm_execute()) {
+        return;
+    }
+
     /* Token-based statement */
-    if (c & 0x80) {
+    if ((c & 0xFF) == TOK_VAR) {
+        /* Implicit LET */
+        do_let();
+    } else if (c & 0x80) {
         token = get_next_char() & 0xFF;
 
         switch (token) {
@@ -163,13 +196,11 @@ execute_statement()
                 break;
 
             default:
-                printf("?UNKNOWN TOKEN %d\n", token);
+                sprintf(buf, "?UNKNOWN TOKEN %d\n", token);
+                out_str(buf);
                 syntax_error();
                 break;
         }
-    } else if (IS_ALPHA(c)) {
-        /* Implicit LET */
-        do_let();
     } else {
         syntax_error();
     }
@@ -186,10 +217,21 @@ int startline;
     line_t *line;
     line_t *next_line;
     int prev_line;
+    char buf[64];
 
     /* Mark as running */
     g_state->running = 1;
 
+    /* Index line numbers for GOTO/GOSUB */
+    if (!g_state->linetab_ok) {
+        index_lines();
+    }
+
+    /* Index DATA items for READ/RESTORE */
+    if (!g_state->datatab_ok) {
+        index_data();
+    }
+
     /* Find starting line */
     if (startline == 0) {
         p = g_state->txttab;
@@ -214,12 +256,14 @@ int startline;
 
     /* Set up error handler */
     if (setjmp(g_state->errtrap) != 0) {
+        temp_release(0);
         if (g_state->errnum != ERR_NONE) {
             if (g_state->errlin >= 0) {
-                printf("?%s IN %d\n", error_message(g_state->errnum), g_state->errlin);
+                sprintf(buf, "?%s IN %d\n", error_message(g_state->errnum), g_state->errlin);
             } else {
-                printf("?%s\n", error_message(g_state->errnum));
+                sprintf(buf, "?%s\n", error_message(g_state->errnum));
             }
+            out_str(buf);
             g_state->errnum = ERR_NONE;
         }
         g_state->running = 0;
@@ -0,0 +1,608 @@
+/*
+ * fold.c - Constant folding of stored lines
+ *
+ * Microsoft BASIC 6502 C Port
+ * K&R C v2 compatible
+ *
+ * Constant subexpressions are found by a parser that mirrors the
+ * precedence rules of eval.c, evaluated once with the evaluator itself,
+ * and replaced by a TOK_FOLD (or TOK_FOLDSTR) item.  The original tokens
+ * stay inline after the folded value so LIST still shows them.
+ */
+
+#include "m6502basic.h"
+
+/* Level below which only unary operators remain */
+#define L_UNARY     (PREC_POWER + 1)
+
+/* Result of parsing a subexpression */
+#define K_VARIABLE  0       /* Not constant */
+#define K_LITERAL   1       /* A single literal, nothing to fold */
+#define K_CONSTANT  2       /* Constant with work to save */
+
+#define MAXFOLDS    32
+
+static unsigned char *fp;           /* Parse position */
+static int lost;                    /* Parse lost track of parentheses */
+
+static struct {
+    unsigned char *start;
+    unsigned char *end;
+    int isstr;
+} folds[MAXFOLDS];
+static int nfolds;
+
+static int f_expr(int level);
+
+/*
+ * Remember a span to fold
+ */
+static void
+add_fold(start, end, isstr)
+unsigned char *start;
+unsigned char *end;
+int isstr;
+{
+    int i;
+
+    if (nfolds >= MAXFOLDS) {
+        return;
+    }
+
+    /* Keep the list in text order */
+    i = nfolds++;
+    while (i > 0 && folds[i-1].start > start) {
+        folds[i] = folds[i-1];
+        i--;
+    }
+    folds[i].start = start;
+    folds[i].end = end;
+    folds[i].isstr = isstr;
+}
+
+/*
+ * Length of the operator at fp for a precedence level, 0 if none
+ * The operators are the evaluator's own, from scan_binop().
+ */
+static int
+op_length(level)
+int level;
+{
+    int n, prec, op;
+
+    n = scan_binop(fp, &prec, &op);
+    return (n > 0 && prec == level) ? n : 0;
+}
+
+/*
+ * Step over the ) closing an argument or subexpression
+ * If it is missing, the evaluator will part company with this parse
+ * at run time, so nothing more in the statement is folded.
+ */
+static void
+f_close()
+{
+    if (*fp == ')') {
+        fp++;
+    } else if (*fp != ',') {
+        lost = 1;
+    }
+}
+
+/*
+ * Skip a parenthesized argument the folder does not look inside
+ */
+static void
+f_skip_parens()
+{
+    int depth;
+
+    if (*fp != '(') {
+        return;
+    }
+
+    depth = 0;
+    while (*fp) {
+        if (*fp == '"') {
+            fp++;
+            while (*fp && *fp != '"') fp++;
+            if (*fp) fp++;
+            continue;
+        }
+        if (*fp == '(') {
+            depth++;
+        } else if (*fp == ')') {
+            if (--depth == 0) {
+                fp++;
+                return;
+            }
+        }
+        fp = skip_token(fp);
+    }
+    lost = 1;
+}
+
+/*
+ * Is a token a function returning a number?
+ */
+static int
+is_numfn(token)
+int token;
+{
+    switch (token) {
+        case TOK_SGN: case TOK_INT: case TOK_ABS: case TOK_SQR:
+        case TOK_RND: case TOK_SIN: case TOK_COS: case TOK_TAN:
+        case TOK_ATN: case TOK_LOG: case TOK_EXP: case TOK_PEEK:
+        case TOK_FRE: case TOK_POS: case TOK_LEN: case TOK_ASC:
+        case TOK_VAL:
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * Primary - literal, variable, parentheses or function call
+ */
+static int
+f_primary()
+{
+    unsigned char *start;
+    unsigned char *end;
+    int token, k;
+
+    token = *fp;
+
+    if (token == TOK_NUM || token == TOK_FOLD) {
+        fp = skip_token(fp);
+        return K_LITERAL;
+    }
+
+    if (token == '(') {
+        fp++;
+        k = f_expr(PREC_OR);
+        if (*fp != ')') {
+            f_close();
+            return K_VARIABLE;
+        }
+        fp++;
+
+        /* A literal in parentheses is no work to fold */
+        return k;
+    }
+
+    if (token == TOK_VAR) {
+        fp = skip_token(fp);
+        if (*fp == '(') {
+            fp++;
+            while (1) {
+                start = fp;
+                if (f_expr(PREC_OR) == K_CONSTANT) {
+                    add_fold(start, fp, 0);
+                }
+                if (*fp != ',') break;
+                fp++;
+            }
+            f_close();
+        }
+        return K_VARIABLE;
+    }
+
+    switch (token) {
+        case TOK_SGN: case TOK_INT: case TOK_ABS: case TOK_SQR:
+        case TOK_SIN: case TOK_COS: case TOK_TAN: case TOK_ATN:
+        case TOK_LOG: case TOK_EXP:
+        case TOK_RND: case TOK_PEEK: case TOK_FRE: case TOK_POS:
+            fp++;
+            if (*fp == '(') fp++;
+            start = fp;
+            k = f_expr(PREC_OR);
+            end = fp;
+            f_close();
+
+            /* Only pure functions of constants are constant */
+            if (token != TOK_RND && token != TOK_PEEK &&
+                token != TOK_FRE && token != TOK_POS) {
+                return k == K_VARIABLE ? K_VARIABLE : K_CONSTANT;
+            }
+            if (k == K_CONSTANT) {
+                add_fold(start, end, 0);
+            }
+            return K_VARIABLE;
+
+        case TOK_LEN: case TOK_ASC: case TOK_VAL:
+            /* String argument */
+            fp++;
+            f_skip_parens();
+            return K_VARIABLE;
+    }
+
+    /* Anything else ends the expression here */
+    return K_VARIABLE;
+}
+
+/*
+ * Unary operators (-, +, NOT)
+ */
+static int
+f_unary()
+{
+    int c;
+
+    c = *fp;
+    if (c == '-' || c == TOK_MINUS || c == '+' || c == TOK_PLUS ||
+        c == TOK_NOT) {
+        fp++;
+        return f_unary() == K_VARIABLE ? K_VARIABLE : K_CONSTANT;
+    }
+
+    return f_primary();
+}
+
+/*
+ * Binary operators at a precedence level and tighter
+ * Constant operands of a variable expression are folded on their own.
+ */
+static int
+f_expr(level)
+int level;
+{
+    unsigned char *start;
+    unsigned char *rstart;
+    unsigned char *opstart;
+    int k, r, n, chained;
+
+    if (level == L_UNARY) {
+        return f_unary();
+    }
+
+    start = fp;
+    k = f_expr(level + 1);
+
+    while ((n = op_length(level)) > 0) {
+        opstart = fp;
+        fp += n;
+        rstart = fp;
+        r = f_expr(level + 1);
+
+        /* The evaluator does not take a relation straight after another
+           one, but would after a folded result, so that stays as it is */
+        chained = (level == PREC_COMPARE && op_length(level) > 0);
+
+        if (k != K_VARIABLE && r != K_VARIABLE && !chained) {
+            k = K_CONSTANT;
+        } else {
+            if (k == K_CONSTANT) {
+                add_fold(start, opstart, 0);
+            }
+            if (r == K_CONSTANT) {
+                add_fold(rstart, fp, 0);
+            }
+            k = K_VARIABLE;
+        }
+
+        /* Comparisons do not chain */
+        if (level == PREC_COMPARE) {
+            break;
+        }
+    }
+
+    return k;
+}
+
+/*
+ * Evaluate the text at txtptr under a local error trap
+ * Returns 0 if evaluation raised an error.
+ */
+static int
+eval_trapped(isstr, num, str)
+int isstr;
+double *num;
+string_t **str;
+{
+    if (setjmp(g_state->errtrap)) {
+        return 0;
+    }
+    if (isstr) {
+        *str = eval_string();
+    } else {
+        *num = eval_expr();
+    }
+    return 1;
+}
+
+/*
+ * Evaluate a span with the interpreter's own evaluator
+ * Returns 0 if it raises an error, which is then left for run time.
+ */
+static int
+eval_span(start, end, isstr, num, str)
+unsigned char *start;
+unsigned char *end;
+int isstr;
+double *num;
+string_t **str;
+{
+    jmp_buf savetrap;
+    unsigned char *buf;
+    unsigned char *savetxt;
+    unsigned char *saveold;
+    int saverun, saveerr, savelin, saveoldlin;
+    int ok;
+
+    buf = (unsigned char *)malloc(end - start + 1);
+    if (!buf) {
+        return 0;
+    }
+    memcpy(buf, start, end - start);
+    buf[end - start] = '\0';
+
+    memcpy(savetrap, g_state->errtrap, sizeof(jmp_buf));
+    savetxt = g_state->txtptr;
+    saveold = g_state->oldtxt;
+    saverun = g_state->running;
+    saveerr = g_state->errnum;
+    savelin = g_state->errlin;
+    saveoldlin = g_state->oldlin;
+
+    *str = NULL;
+    g_state->txtptr = buf;
+    ok = eval_trapped(isstr, num, str) &&
+         g_state->txtptr == buf + (end - start);
+
+    memcpy(g_state->errtrap, savetrap, sizeof(jmp_buf));
+    g_state->txtptr = savetxt;
+    g_state->oldtxt = saveold;
+    g_state->running = saverun;
+    g_state->errnum = saveerr;
+    g_state->errlin = savelin;
+    g_state->oldlin = saveoldlin;
+
+    free(buf);
+    return ok;
+}
+
+/*
+ * Write a folded item for a span - returns bytes written, 0 if the
+ * span cannot be folded
+ */
+static int
+emit_fold(out, start, end, isstr)
+unsigned char *out;
+unsigned char *start;
+unsigned char *end;
+int isstr;
+{
+    double num;
+    string_t *str;
+    unsigned char *p;
+    int n, i, c;
+    int mark;
+
+    n = end - start;
+    mark = temp_mark();
+    if (n > 0x3FFF || !eval_span(start, end, isstr, &num, &str)) {
+        temp_release(mark);
+        return 0;
+    }
+
+    p = out;
+    if (isstr) {
+        /* Only plain printable text can sit in the line */
+        if (!str || str->len > 127) {
+            temp_release(mark);
+            return 0;
+        }
+        for (i = 0; i < str->len; i++) {
+            c = (unsigned char)str->ptr[i];
+            if (c < ' ' || c > '~' || c == '"' || c == ':') {
+                temp_release(mark);
+                return 0;
+            }
+        }
+        *p++ = TOK_FOLDSTR;
+        *p++ = 0x80 | str->len;
+        memcpy(p, str->ptr, str->len);
+        p += str->len;
+        temp_release(mark);
+    } else {
+        *p++ = TOK_FOLD;
+        pack_number(p, num);
+        p += NUMLEN;
+    }
+    *p++ = 0x80 | (n >> 7);
+    *p++ = 0x80 | (n & 0x7F);
+    memcpy(p, start, n);
+    p += n;
+
+    return p - out;
+}
+
+/*
+ * Fold the constant subexpressions of a tokenized line
+ * Returns a new buffer and updates len, or NULL if nothing was folded.
+ */
+unsigned char *
+fold_line(tokens, len)
+unsigned char *tokens;
+int *len;
+{
+    unsigned char *p;
+    unsigned char *out;
+    unsigned char *q;
+    int c, prev, level, k, i, n;
+    int stmt, smark;
+
+    nfolds = 0;
+    smark = 0;
+    lost = 0;
+
+    /*
+     * Walk the line finding where expressions start.  prev remembers
+     * what came before, which decides how much of the text after it
+     * belongs to one subexpression.
+     */
+    p = tokens;
+    prev = ':';
+    stmt = 1;
+    while (1) {
+        /* Lost track - drop this statement's folds and skip the rest */
+        if (lost) {
+            nfolds = smark;
+            lost = 0;
+            while (*p && *p != ':' && *p != TOK_REM && *p != TOK_DATA) {
+                if (*p == '"') {
+                    p++;
+                    while (*p && *p != '"') p++;
+                    if (*p) p++;
+                } else {
+                    p = skip_token(p);
+                }
+            }
+        }
+        if (*p == '\0') {
+            break;
+        }
+        c = *p;
+
+        /* Text that is not tokens */
+        if (c == TOK_REM || c == TOK_DATA) {
+            break;
+        }
+        if (c == '"') {
+            p++;
+            while (*p && *p != '"') p++;
+            if (*p) p++;
+            prev = '"';
+            stmt = 0;
+            continue;
+        }
+
+        /* Assignment target - what follows '=' is a whole expression */
+        if (c == TOK_VAR && stmt) {
+            fp = p;
+            f_primary();
+            p = fp;
+            if (*p == '=' || *p == TOK_EQ) {
+                p++;
+                prev = ':';
+            } else {
+                prev = TOK_VAR;
+            }
+            stmt = 0;
+            continue;
+        }
+
+        /* A binary operator rather than the start of an operand */
+        if ((c == '-' || c == '+') &&
+            (prev == TOK_VAR || prev == TOK_NUM || prev == ')' ||
+             prev == '"' || IS_DIGIT(prev))) {
+            p++;
+            prev = c;
+            stmt = 0;
+            continue;
+        }
+
+        /* Functions whose parentheses the evaluator reads itself - only
+           the argument is folded, except CHR$ of a constant as a whole */
+        if (c == TOK_CHR || c == TOK_STR || c == TOK_TAB || c == TOK_SPC) {
+            fp = p + 1;
+            if (*fp == '(') fp++;
+            q = fp;
+            k = f_expr(PREC_OR);
+            if (*fp == ')') {
+                if (c == TOK_CHR && k != K_VARIABLE) {
+                    add_fold(p, fp + 1, 1);
+                } else if (k == K_CONSTANT) {
+                    add_fold(q, fp, 0);
+                }
+                fp++;
+            } else {
+                if (k == K_CONSTANT) {
+                    add_fold(q, fp, 0);
+                }
+                f_close();
+            }
+            p = fp;
+            prev = ')';
+            stmt = 0;
+            continue;
+        }
+
+        if (c == TOK_NUM || c == TOK_VAR || c == '(' || c == '-' ||
+            c == '+' || c == TOK_NOT || is_numfn(c)) {
+            /* Not a statement - leave it for the error */
+            if (stmt) {
+                lost = 1;
+                continue;
+            }
+            switch (prev) {
+                case '^': case TOK_POWER:
+                    level = L_UNARY; break;
+                case '*': case '/': case TOK_MULT: case TOK_DIV:
+                    level = PREC_POWER; break;
+                case '+': case '-': case TOK_PLUS: case TOK_MINUS:
+                    level = PREC_MULT; break;
+                case '<': case '>': case '=': case TOK_LT: case TOK_GT:
+                case TOK_EQ:
+                    level = PREC_ADD; break;
+                case TOK_AND:
+                    level = PREC_COMPARE; break;
+                case TOK_OR:
+                    level = PREC_AND; break;
+                default:
+                    level = PREC_OR; break;
+            }
+
+            fp = p;
+            if (f_expr(level) == K_CONSTANT) {
+                add_fold(p, fp, 0);
+            }
+            if (fp == p) {
+                fp = skip_token(p);
+            }
+            p = fp;
+            prev = TOK_VAR;
+            stmt = 0;
+            continue;
+        }
+
+        /* Anything else - keep going after it */
+        stmt = (c == ':' || c == TOK_THEN || c == TOK_LET ||
+                c == TOK_FOR);
+        if (c == ':') {
+            smark = nfolds;
+        }
+        prev = c;
+        p = skip_token(p);
+    }
+
+    if (nfolds == 0) {
+        return NULL;
+    }
+
+    /* Each fold adds at most a header and a 127 character value */
+    out = (unsigned char *)malloc(*len + nfolds * (127 + 4));
+    if (!out) {
+        return NULL;
+    }
+
+    q = out;
+    p = tokens;
+    for (i = 0; i < nfolds; i++) {
+        memcpy(q, p, folds[i].start - p);
+        q += folds[i].start - p;
+        n = emit_fold(q, folds[i].start, folds[i].end, folds[i].isstr);
+        if (n == 0) {
+            n = folds[i].end - folds[i].start;
+            memcpy(q, folds[i].start, n);
+        }
+        q += n;
+        p = folds[i].end;
+    }
+    n = *len - (p - tokens);
+    memcpy(q, p, n);
+    q += n;
+
+    *len = q - out;
+    return out;
+}
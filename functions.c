@@ -168,6 +168,9 @@ fn_fre(x)
 double x;
 {
     x = x;  /* suppress unused warning */
+
+    /* Like the original, only count space no string is using */
+    collect_strings();
     return (double)(g_state->fretop - g_state->strend);
 }
 
@@ -218,10 +221,10 @@ int n;
 
     if (n < 0 || n > 255) {
         error(ERR_ILLEGAL_FUNC);
-        return alloc_string(0);
+        return temp_string(0);
     }
 
-    s = alloc_string(1);
+    s = temp_string(1);
     if (s && s->ptr) {
         s->ptr[0] = (char)n;
         s->ptr[1] = '\0';
@@ -236,10 +239,11 @@ string_t *
 fn_str(x)
 double x;
 {
-    char buf[32];
+    string_t *s;
 
-    sprintf(buf, "%g", x);
-    return string_from_cstr(buf);
+    s = temp_string(NUMBUFLEN);
+    s->len = fmt_number(s->ptr, x);
+    return s;
 }
 
 /*
@@ -249,10 +253,15 @@ double
 fn_val(s)
 string_t *s;
 {
+    double num;
+
     if (!s || !s->ptr || s->len == 0) {
         return 0.0;
     }
-    return atof(s->ptr);
+
+    /* Substrings are views without a terminator */
+    scan_number(s->ptr, s->len, &num);
+    return num;
 }
 
 /*
@@ -263,22 +272,15 @@ fn_left(s, n)
 string_t *s;
 int n;
 {
-    string_t *result;
-
     if (!s || n <= 0) {
-        return alloc_string(0);
+        return temp_string(0);
     }
 
     if (n > s->len) {
         n = s->len;
     }
 
-    result = alloc_string(n);
-    if (result && result->ptr && s->ptr) {
-        memcpy(result->ptr, s->ptr, n);
-        result->ptr[n] = '\0';
-    }
-    return result;
+    return sub_string(s, 0, n);
 }
 
 /*
@@ -289,11 +291,10 @@ fn_right(s, n)
 string_t *s;
 int n;
 {
-    string_t *result;
     int start;
 
     if (!s || n <= 0) {
-        return alloc_string(0);
+        return temp_string(0);
     }
 
     if (n > s->len) {
@@ -301,12 +302,7 @@ int n;
     }
 
     start = s->len - n;
-    result = alloc_string(n);
-    if (result && result->ptr && s->ptr) {
-        memcpy(result->ptr, s->ptr + start, n);
-        result->ptr[n] = '\0';
-    }
-    return result;
+    return sub_string(s, start, n);
 }
 
 /*
@@ -318,29 +314,22 @@ string_t *s;
 int start;
 int len;
 {
-    string_t *result;
-
     if (!s || start < 1 || len < 0) {
         if (start < 1 && s) {
             error(ERR_ILLEGAL_FUNC);
         }
-        return alloc_string(0);
+        return temp_string(0);
     }
 
     start--;  /* Convert to 0-based */
 
     if (start >= s->len) {
-        return alloc_string(0);
+        return temp_string(0);
     }
 
     if (start + len > s->len) {
         len = s->len - start;
     }
 
-    result = alloc_string(len);
-    if (result && result->ptr && s->ptr) {
-        memcpy(result->ptr, s->ptr + start, len);
-        result->ptr[len] = '\0';
-    }
-    return result;
+    return sub_string(s, start, len);
 }
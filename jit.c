@@ -0,0 +1,879 @@
+/*
+ * jit.c - Native code for hot statements
+ *
+ * Microsoft BASIC 6502 C Port
+ * K&R C v2 compatible
+ *
+ * Once a compiled statement has run JIT_HOT times, vm_execute() asks
+ * for it to be translated to x86-64 machine code.  The statements that
+ * get that hot are the bodies of FOR loops and GOTO loops, and they are
+ * mostly assignments, arithmetic, array accesses and IF tests, so that
+ * is what is translated: a statement using any other instruction is
+ * left to vm_run().
+ *
+ * The depth of the evaluation stack at every instruction is known when
+ * translating, so stack slot n is simply register xmm<n> (integers are
+ * kept there as their 64-bit pattern) and no stack pointer is needed.
+ * Around calls to C the live slots are saved in the frame, which also
+ * gives the array helpers their subscripts in vmcell_t layout.  The
+ * element address for a store is kept in rbx.  Errors are raised by
+ * calling error(), which does not return.
+ *
+ * Code goes into one buffer that is writable only while translating.
+ * It is emptied along with the VM's code by vm_flush(), and when it
+ * fills up, since code the VM has evicted is still taking room there.
+ * Translation is off until jit_enable() is called, from the -j option.
+ */
+
+#include "m6502basic.h"
+
+#if HAVE_JIT
+
+#include <sys/mman.h>
+
+#define JIT_SIZE    262144L /* Bytes of native code */
+#define JIT_SLACK   320     /* Room needed for one instruction */
+#define JIT_REGS    14      /* Stack slots, xmm0-xmm13 */
+#define JIT_FRAME   (JIT_REGS * 8)
+
+/* Scratch registers */
+#define RAX     0
+#define RCX     1
+#define RBX     3
+#define RSI     6
+#define RDI     7
+#define XTMP    15
+
+/* cmpsd predicates */
+#define CMP_EQ  0
+#define CMP_LT  1
+#define CMP_LE  2
+#define CMP_NE  4
+
+#define MINUS_ONE   0xBFF0000000000000UL    /* -1.0, BASIC's true */
+#define SIGN_BIT    0x8000000000000000UL
+
+static int jit_on;
+static unsigned char *jit_mem;          /* Code buffer */
+static long jit_used;                   /* Bytes of it in use */
+static unsigned char *pc;               /* Where code is emitted */
+
+/*
+ * Runtime helpers called from native code
+ */
+
+/*
+ * Numeric array element, subscripts below top
+ */
+static double
+jit_arr(slot, arg, top)
+int slot;
+int arg;
+vmcell_t *top;
+{
+    int indices[11];
+    double *addr;
+
+    vm_indices(top, arg, indices);
+    addr = array_num_at(slot_array(slot, 1), indices, SUB_COUNT(arg));
+    return addr ? *addr : 0.0;
+}
+
+/*
+ * Address of a numeric array element, subscripts below top
+ */
+static double *
+jit_elem(slot, arg, top)
+int slot;
+int arg;
+vmcell_t *top;
+{
+    int indices[11];
+
+    vm_indices(top, arg, indices);
+    return array_num_at(slot_array(slot, 1), indices, SUB_COUNT(arg));
+}
+
+/*
+ * Integer array element, subscripts below top
+ */
+static long
+jit_iarr(slot, arg, top)
+int slot;
+int arg;
+vmcell_t *top;
+{
+    int indices[11];
+    short *addr;
+
+    vm_indices(top, arg, indices);
+    addr = array_int_at(slot_array(slot, 1), indices, SUB_COUNT(arg));
+    return addr ? *addr : 0;
+}
+
+/*
+ * Address of an integer array element, subscripts below top
+ */
+static short *
+jit_ielem(slot, arg, top)
+int slot;
+int arg;
+vmcell_t *top;
+{
+    int indices[11];
+
+    vm_indices(top, arg, indices);
+    return array_int_at(slot_array(slot, 1), indices, SUB_COUNT(arg));
+}
+
+/*
+ * Transfer control to a line
+ */
+static void
+jit_goto(line)
+line_t *line;
+{
+    g_state->curlin = line->linenum;
+    g_state->txtptr = line->text;
+    g_state->curline_ptr = line;
+}
+
+/*
+ * False IF - continue after the end of the line
+ */
+static void
+jit_skip(offset)
+int offset;
+{
+    g_state->txtptr = g_state->txttab + offset;
+}
+
+/*
+ * Instruction encoding
+ */
+
+/*
+ * Emit one byte
+ */
+static void
+emit1(c)
+int c;
+{
+    *pc++ = (unsigned char)c;
+}
+
+/*
+ * Emit a 32-bit little-endian value
+ */
+static void
+emit4(v)
+long v;
+{
+    emit1((int)(v & 0xFF));
+    emit1((int)((v >> 8) & 0xFF));
+    emit1((int)((v >> 16) & 0xFF));
+    emit1((int)((v >> 24) & 0xFF));
+}
+
+/*
+ * mov r, imm64
+ */
+static void
+load_imm(r, v)
+int r;
+unsigned long v;
+{
+    int i;
+
+    emit1(0x48);
+    emit1(0xB8 + r);
+    for (i = 0; i < 8; i++) {
+        emit1((int)(v & 0xFF));
+        v >>= 8;
+    }
+}
+
+/*
+ * mov r32, imm32
+ */
+static void
+load_int(r, v)
+int r;
+long v;
+{
+    emit1(0xB8 + r);
+    emit4(v);
+}
+
+/*
+ * SSE instruction between registers - prefix, 0F op, then reg and rm
+ * as the instruction defines them, with REX.W if w
+ */
+static void
+sse(pfx, w, op, reg, rm)
+int pfx, w, op, reg, rm;
+{
+    int rex;
+
+    rex = (w ? 8 : 0) | (reg >= 8 ? 4 : 0) | (rm >= 8 ? 1 : 0);
+    emit1(pfx);
+    if (rex) {
+        emit1(0x40 | rex);
+    }
+    emit1(0x0F);
+    emit1(op);
+    emit1(0xC0 | (reg & 7) << 3 | (rm & 7));
+}
+
+/*
+ * SSE instruction with a [base+disp] operand, disp below 128
+ */
+static void
+sse_mem(pfx, op, reg, base, disp)
+int pfx, op, reg, base, disp;
+{
+    emit1(pfx);
+    if (reg >= 8) {
+        emit1(0x44);
+    }
+    emit1(0x0F);
+    emit1(op);
+    emit1(0x40 | (reg & 7) << 3 | base);
+    if (base == 4) {
+        emit1(0x24);            /* SIB for rsp */
+    }
+    emit1(disp);
+}
+
+/*
+ * movsd x, [base+disp] and movsd [base+disp], x
+ */
+#define LOAD_SD(x, base, disp)  sse_mem(0xF2, 0x10, x, base, disp)
+#define STORE_SD(x, base, disp) sse_mem(0xF2, 0x11, x, base, disp)
+
+/*
+ * movq between an xmm register and rax or rcx
+ */
+#define TO_XMM(x, r)    sse(0x66, 1, 0x6E, x, r)
+#define FROM_XMM(r, x)  sse(0x66, 1, 0x7E, x, r)
+
+/*
+ * Copy one xmm register to another
+ */
+static void
+move_xmm(to, from)
+int to, from;
+{
+    if (to != from) {
+        sse(0x66, 0, 0x28, to, from);   /* movapd */
+    }
+}
+
+/*
+ * Put a double's bit pattern in XTMP
+ */
+static void
+load_mask(bits)
+unsigned long bits;
+{
+    load_imm(RAX, bits);
+    TO_XMM(XTMP, RAX);
+}
+
+/*
+ * Forward jump, cc 0 for jmp - returns where to patch
+ */
+static unsigned char *
+jump(cc)
+int cc;
+{
+    unsigned char *at;
+
+    if (cc) {
+        emit1(0x0F);
+        emit1(cc);
+    } else {
+        emit1(0xE9);
+    }
+    at = pc;
+    emit4(0L);
+    return at;
+}
+
+/*
+ * Point a forward jump here
+ */
+static void
+land(at)
+unsigned char *at;
+{
+    unsigned char *save;
+
+    save = pc;
+    pc = at;
+    emit4((long)(save - (at + 4)));
+    pc = save;
+}
+
+/*
+ * Call a C function
+ */
+static void
+call(fn)
+unsigned long fn;
+{
+    load_imm(RAX, fn);
+    emit1(0xFF);
+    emit1(0xD0);
+}
+
+/*
+ * Save stack slots 0..n-1 in the frame
+ */
+static void
+spill(n)
+int n;
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        STORE_SD(i, 4, i * 8);
+    }
+}
+
+/*
+ * Restore stack slots 0..n-1 from the frame
+ */
+static void
+reload(n)
+int n;
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        LOAD_SD(i, 4, i * 8);
+    }
+}
+
+/*
+ * Return from the native code
+ */
+static void
+epilogue()
+{
+    emit1(0x48); emit1(0x83); emit1(0xC4); emit1(JIT_FRAME);   /* add rsp */
+    emit1(0x5B);                                            /* pop rbx */
+    emit1(0xC3);                                            /* ret */
+}
+
+/*
+ * Raise an error - error() does not come back
+ */
+static void
+jit_error(errnum)
+int errnum;
+{
+    load_int(RDI, (long)errnum);
+    call((unsigned long)error);
+}
+
+/*
+ * Call an array helper for n subscripts in the slots below depth
+ */
+static void
+call_array(fn, ip, depth)
+unsigned long fn;
+vminsn_t *ip;
+int depth;
+{
+    spill(depth);
+    load_int(RDI, (long)ip->u.slot);
+    load_int(RSI, (long)ip->arg);
+    emit1(0x48); emit1(0x8D); emit1(0x54);      /* lea rdx, [rsp+disp] */
+    emit1(0x24); emit1(depth * 8);
+    call(fn);
+}
+
+/*
+ * Check that ax holds a value a % variable can take
+ */
+static void
+check_int()
+{
+    unsigned char *ok;
+
+    emit1(0x48); emit1(0x8D); emit1(0x88);      /* lea rcx, [rax+8000h] */
+    emit4(0x8000L);
+    emit1(0x48); emit1(0x81); emit1(0xF9);      /* cmp rcx, 0FFFFh */
+    emit4(0xFFFFL);
+    ok = jump(0x86);                            /* jbe */
+    jit_error(ERR_ILLEGAL_FUNC);
+    land(ok);
+}
+
+/*
+ * Integer operation on slots a and b, leaving the result in a - c1 to
+ * c3 are the bytes after REX.W of the instruction combining rax and rcx
+ */
+static void
+int_op(a, b, c1, c2, c3)
+int a, b, c1, c2, c3;
+{
+    FROM_XMM(RAX, a);
+    FROM_XMM(RCX, b);
+    emit1(0x48);
+    emit1(c1);
+    emit1(c2);
+    if (c3) {
+        emit1(c3);
+    }
+    TO_XMM(a, RAX);
+}
+
+/*
+ * Turn the flags into BASIC's -1 or 0 in slot x, setcc being cc
+ */
+static void
+int_flag(x, cc)
+int x, cc;
+{
+    emit1(0x0F); emit1(cc); emit1(0xC0);        /* setcc al */
+    emit1(0x0F); emit1(0xB6); emit1(0xC0);      /* movzx eax, al */
+    emit1(0x48); emit1(0xF7); emit1(0xD8);      /* neg rax */
+    TO_XMM(x, RAX);
+}
+
+/*
+ * Check the code can be translated - every instruction is one this
+ * file knows and the stack fits the registers
+ */
+static int
+jit_check(insn)
+vminsn_t *insn;
+{
+    vminsn_t *ip;
+    int depth;
+
+    depth = 0;
+    for (ip = insn; ; ip++) {
+        switch (ip->op) {
+            case OP_HALT:
+                return 1;
+
+            case OP_NUM: case OP_VAR: case OP_INUM: case OP_IVAR:
+                depth++;
+                break;
+
+            case OP_ARR: case OP_IARR:
+                depth -= SUB_COUNT(ip->arg) - 1;
+                break;
+
+            case OP_ELEM: case OP_IELEM:
+                depth -= SUB_COUNT(ip->arg);
+                break;
+
+            case OP_NEG: case OP_NOT: case OP_FN: case OP_FLT:
+            case OP_FLT2: case OP_CINT: case OP_INEG: case OP_INOT:
+                break;
+
+            case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV:
+            case OP_POW: case OP_REL: case OP_AND: case OP_OR:
+            case OP_IADD: case OP_ISUB: case OP_IMUL: case OP_IREL:
+            case OP_IAND: case OP_IOR:
+            case OP_LET: case OP_STORE: case OP_ILET: case OP_ISTORE:
+            case OP_IF: case OP_IIF:
+                depth--;
+                break;
+
+            case OP_GOTO:
+                if (!ip->u.line) {
+                    return 0;
+                }
+                break;
+
+            default:
+                return 0;
+        }
+        if (depth > JIT_REGS) {
+            return 0;
+        }
+    }
+}
+
+/*
+ * Translate checked code into the free end of the buffer - NULL if it
+ * does not fit
+ */
+static jitfn_t
+jit_translate(insn)
+vminsn_t *insn;
+{
+    vminsn_t *ip;
+    unsigned char *start;
+    unsigned char *at, *at2;
+    unsigned long bits;
+    int k, a, b, n, cc;
+
+    if (jit_used + JIT_SLACK > JIT_SIZE) {
+        return NULL;
+    }
+    if (mprotect(jit_mem, JIT_SIZE, PROT_READ | PROT_WRITE) != 0) {
+        return NULL;
+    }
+
+    start = pc = jit_mem + jit_used;
+
+    emit1(0x53);                                            /* push rbx */
+    emit1(0x48); emit1(0x83); emit1(0xEC); emit1(JIT_FRAME);   /* sub rsp */
+
+    k = 0;
+    for (ip = insn; ip->op != OP_HALT; ip++) {
+        if (pc + JIT_SLACK > jit_mem + JIT_SIZE) {
+            start = NULL;
+            break;
+        }
+
+        /* The top two slots */
+        a = k - 2;
+        b = k - 1;
+
+        switch (ip->op) {
+            case OP_NUM:
+                memcpy(&bits, &ip->u.num, sizeof(bits));
+                load_imm(RAX, bits);
+                TO_XMM(k, RAX);
+                k++;
+                break;
+
+            case OP_VAR:
+                load_imm(RAX, (unsigned long)&ip->u.var->value.numval);
+                LOAD_SD(k, RAX, 0);
+                k++;
+                break;
+
+            case OP_ARR:
+            case OP_IARR:
+                call_array(ip->op == OP_ARR ? (unsigned long)jit_arr :
+                           (unsigned long)jit_iarr, ip, k);
+                k -= SUB_COUNT(ip->arg);
+                if (ip->op == OP_ARR) {
+                    move_xmm(k, 0);
+                } else {
+                    TO_XMM(k, RAX);
+                }
+                reload(k);
+                k++;
+                break;
+
+            case OP_ELEM:
+            case OP_IELEM:
+                call_array(ip->op == OP_ELEM ? (unsigned long)jit_elem :
+                           (unsigned long)jit_ielem, ip, k);
+                emit1(0x48); emit1(0x89); emit1(0xC3);  /* mov rbx, rax */
+                k -= SUB_COUNT(ip->arg);
+                reload(k);
+                break;
+
+            case OP_NEG:
+                load_mask(SIGN_BIT);
+                sse(0x66, 0, 0x57, b, XTMP);            /* xorpd */
+                break;
+
+            case OP_NOT:
+                sse(0x66, 0, 0x57, XTMP, XTMP);
+                sse(0xF2, 0, 0xC2, b, XTMP);            /* cmpsd */
+                emit1(CMP_EQ);
+                load_mask(MINUS_ONE);
+                sse(0x66, 0, 0x54, b, XTMP);            /* andpd */
+                break;
+
+            case OP_ADD:
+                sse(0xF2, 0, 0x58, a, b);
+                k--;
+                break;
+
+            case OP_SUB:
+                sse(0xF2, 0, 0x5C, a, b);
+                k--;
+                break;
+
+            case OP_MUL:
+                sse(0xF2, 0, 0x59, a, b);
+                k--;
+                break;
+
+            case OP_DIV:
+                sse(0x66, 0, 0x57, XTMP, XTMP);
+                sse(0x66, 0, 0x2E, b, XTMP);            /* ucomisd */
+                at = jump(0x8A);                        /* jp */
+                at2 = jump(0x85);                       /* jne */
+                jit_error(ERR_DIV_ZERO);
+                land(at);
+                land(at2);
+                sse(0xF2, 0, 0x5E, a, b);
+                k--;
+                break;
+
+            case OP_POW:
+                spill(k);
+                LOAD_SD(0, 4, a * 8);
+                LOAD_SD(1, 4, b * 8);
+                call((unsigned long)pow);
+                move_xmm(a, 0);
+                k--;
+                reload(k - 1);
+                break;
+
+            case OP_REL:
+                /* > and >= are < and <= the other way round */
+                switch (ip->arg) {
+                    case 1: cc = CMP_LT; n = 0; break;
+                    case 2: cc = CMP_LT; n = 1; break;
+                    case 3: cc = CMP_LE; n = 0; break;
+                    case 4: cc = CMP_LE; n = 1; break;
+                    case 5: cc = CMP_NE; n = 0; break;
+                    default: cc = CMP_EQ; n = 0; break;
+                }
+                if (n) {
+                    sse(0xF2, 0, 0xC2, b, a);
+                    emit1(cc);
+                    move_xmm(a, b);
+                } else {
+                    sse(0xF2, 0, 0xC2, a, b);
+                    emit1(cc);
+                }
+                load_mask(MINUS_ONE);
+                sse(0x66, 0, 0x54, a, XTMP);
+                k--;
+                break;
+
+            case OP_AND:
+            case OP_OR:
+                sse(0xF2, 1, 0x2C, RAX, a);             /* cvttsd2si */
+                sse(0xF2, 1, 0x2C, RCX, b);
+                emit1(0x48);
+                emit1(ip->op == OP_AND ? 0x21 : 0x09);
+                emit1(0xC8);
+                sse(0xF2, 1, 0x2A, a, RAX);             /* cvtsi2sd */
+                k--;
+                break;
+
+            case OP_FN:
+                spill(k);
+                LOAD_SD(0, 4, b * 8);
+                load_int(RDI, (long)ip->arg);
+                call((unsigned long)vm_fn);
+                move_xmm(b, 0);
+                reload(b);
+                break;
+
+            case OP_LET:
+                load_imm(RAX, (unsigned long)&ip->u.var->value.numval);
+                STORE_SD(b, RAX, 0);
+                k--;
+                break;
+
+            case OP_STORE:
+                emit1(0x48); emit1(0x85); emit1(0xDB);  /* test rbx, rbx */
+                at = jump(0x84);
+                STORE_SD(b, RBX, 0);
+                land(at);
+                k--;
+                break;
+
+            case OP_GOTO:
+                spill(k);
+                load_imm(RDI, (unsigned long)ip->u.line);
+                call((unsigned long)jit_goto);
+                reload(k);
+                break;
+
+            case OP_IF:
+            case OP_IIF:
+                if (ip->op == OP_IF) {
+                    sse(0x66, 0, 0x57, XTMP, XTMP);
+                    sse(0x66, 0, 0x2E, b, XTMP);
+                    at = jump(0x8A);
+                } else {
+                    FROM_XMM(RAX, b);
+                    emit1(0x48); emit1(0x85); emit1(0xC0);  /* test */
+                    at = NULL;
+                }
+                at2 = jump(0x85);
+                load_int(RDI, (long)ip->arg);
+                call((unsigned long)jit_skip);
+                epilogue();
+                if (at) {
+                    land(at);
+                }
+                land(at2);
+                k--;
+                break;
+
+            case OP_INUM:
+                emit1(0x48); emit1(0xC7); emit1(0xC0);  /* mov rax, imm */
+                emit4((long)ip->arg);
+                TO_XMM(k, RAX);
+                k++;
+                break;
+
+            case OP_IVAR:
+                load_imm(RAX, (unsigned long)&ip->u.var->value.intval);
+                emit1(0x48); emit1(0x0F); emit1(0xBF);  /* movsx rax, */
+                emit1(0x00);                            /*   word [rax] */
+                TO_XMM(k, RAX);
+                k++;
+                break;
+
+            case OP_FLT:
+            case OP_FLT2:
+                n = (ip->op == OP_FLT) ? b : a;
+                FROM_XMM(RAX, n);
+                sse(0xF2, 1, 0x2A, n, RAX);
+                break;
+
+            case OP_CINT:
+                spill(k);
+                LOAD_SD(0, 4, b * 8);
+                call((unsigned long)int_value);
+                emit1(0x48); emit1(0x63); emit1(0xC0);  /* movsxd rax, eax */
+                TO_XMM(b, RAX);
+                reload(b);
+                break;
+
+            case OP_IADD:
+                int_op(a, b, 0x01, 0xC8, 0);
+                k--;
+                break;
+
+            case OP_ISUB:
+                int_op(a, b, 0x29, 0xC8, 0);
+                k--;
+                break;
+
+            case OP_IMUL:
+                int_op(a, b, 0x0F, 0xAF, 0xC1);
+                k--;
+                break;
+
+            case OP_IAND:
+                int_op(a, b, 0x21, 0xC8, 0);
+                k--;
+                break;
+
+            case OP_IOR:
+                int_op(a, b, 0x09, 0xC8, 0);
+                k--;
+                break;
+
+            case OP_INEG:
+                FROM_XMM(RAX, b);
+                emit1(0x48); emit1(0xF7); emit1(0xD8);  /* neg rax */
+                TO_XMM(b, RAX);
+                break;
+
+            case OP_IREL:
+                FROM_XMM(RAX, a);
+                FROM_XMM(RCX, b);
+                emit1(0x48); emit1(0x39); emit1(0xC8);  /* cmp rax, rcx */
+                switch (ip->arg) {
+                    case 1: cc = 0x9C; break;           /* setl */
+                    case 2: cc = 0x9F; break;           /* setg */
+                    case 3: cc = 0x9E; break;           /* setle */
+                    case 4: cc = 0x9D; break;           /* setge */
+                    case 5: cc = 0x95; break;           /* setne */
+                    default: cc = 0x94; break;          /* sete */
+                }
+                int_flag(a, cc);
+                k--;
+                break;
+
+            case OP_INOT:
+                FROM_XMM(RAX, b);
+                emit1(0x48); emit1(0x85); emit1(0xC0);  /* test rax, rax */
+                int_flag(b, 0x94);
+                break;
+
+            case OP_ILET:
+                FROM_XMM(RAX, b);
+                check_int();
+                load_imm(RCX, (unsigned long)&ip->u.var->value.intval);
+                emit1(0x66); emit1(0x89); emit1(0x01);  /* mov [rcx], ax */
+                k--;
+                break;
+
+            case OP_ISTORE:
+                FROM_XMM(RAX, b);
+                check_int();
+                emit1(0x48); emit1(0x85); emit1(0xDB);
+                at = jump(0x84);
+                emit1(0x66); emit1(0x89); emit1(0x03);  /* mov [rbx], ax */
+                land(at);
+                k--;
+                break;
+        }
+    }
+
+    if (start) {
+        epilogue();
+        jit_used = ((pc - jit_mem) + 15) & ~15L;
+    }
+
+    mprotect(jit_mem, JIT_SIZE, PROT_READ | PROT_EXEC);
+    return (jitfn_t)start;
+}
+
+/*
+ * Translate compiled code to native code - NULL if it cannot be
+ */
+jitfn_t
+jit_compile(insn)
+vminsn_t *insn;
+{
+    jitfn_t fn;
+
+    if (!jit_on || !jit_check(insn)) {
+        return NULL;
+    }
+    fn = jit_translate(insn);
+
+    /* Full - much of it may belong to statements the VM has since
+       dropped, so start the buffer again */
+    if (!fn && jit_used > 0) {
+        vm_unjit();
+        jit_used = 0;
+        fn = jit_translate(insn);
+    }
+    return fn;
+}
+
+/*
+ * Forget all native code
+ */
+void
+jit_flush()
+{
+    jit_used = 0;
+}
+
+/*
+ * Turn translation on or off
+ */
+void
+jit_enable(on)
+int on;
+{
+    void *mem;
+
+    if (on && !jit_mem) {
+        mem = mmap(NULL, JIT_SIZE, PROT_READ | PROT_EXEC,
+                   MAP_PRIVATE | MAP_ANON, -1, 0);
+        if (mem == MAP_FAILED) {
+            return;
+        }
+        jit_mem = (unsigned char *)mem;
+    }
+    jit_on = on;
+}
+
+#endif /* HAVE_JIT */
@@ -47,25 +47,49 @@
 #define IS_16BIT 0
 #endif
 
+/* Native code for hot statements, x86-64 hosts only */
+#if defined(__x86_64__) && (PLATFORM_LINUX || PLATFORM_MACOS) && !defined(NO_JIT)
+#define HAVE_JIT 1
+#define JIT_HOT 16      /* Runs before a statement is translated */
+#else
+#define HAVE_JIT 0
+#endif
+
 /* Basic constants - matching original 6502 BASIC */
 #define LINLEN 72       /* Terminal line length */
 #define BUFLEN 72       /* Input buffer size */
 #define NAMLEN 2        /* Variable name length (2 chars in original) */
 #define CLMWID 14       /* Column width for PRINT commas */
+#define NUMBUFLEN 20    /* Longest formatted number, with NUL */
+
+/* Variable table - one slot per possible name: first letter A-Z,
+   optional second letter or digit, and type */
+#define VAR_SLOTS (26 * 37 * 3)
+#define SLOT_TYPE(slot) ((slot) % 3)
 
 /* Platform-specific limits */
 #if IS_16BIT
 #define MAXLIN 32767    /* Maximum line number */
 #define PROGRAM_SIZE 65536L /* Max program memory - probed at runtime */
+#define OUTBUFSIZ 512   /* Console output buffer */
 #else
 #define MAXLIN 63999    /* Maximum line number */
 #define PROGRAM_SIZE 65536L /* Program memory size */
+#define OUTBUFSIZ 8192  /* Console output buffer */
 #endif
 
 /* Data type indicators */
 #define TYPE_NUM    0   /* Numeric (default) */
 #define TYPE_STR    1   /* String ($) */
-#define TYPE_INT    2   /* Integer (%) - if INTPRC enabled */
+#define TYPE_INT    2   /* Integer (%), 16 bits */
+
+/* Binary operator precedence, loosest first */
+#define PREC_OR      0
+#define PREC_AND     1
+#define PREC_COMPARE 2
+#define PREC_ADD     3
+#define PREC_MULT    4
+#define PREC_POWER   5
 
 /* Token definitions - Statement tokens (MSB set, >= 128) */
 #define TOK_END     128
@@ -143,6 +167,23 @@
 #define TOK_RIGHT   194
 #define TOK_MID     195
 
+/* Variable reference: TOK_VAR, slot (two bytes of 6 bits, high bit
+   set), length of name as typed (high bit set), name as typed */
+#define TOK_VAR     196
+
+/* Numeric literal: TOK_NUM, the 64-bit double packed into NUMLEN bytes
+   of 7 bits (high bit set), length of literal as typed (high bit set),
+   literal as typed */
+#define TOK_NUM     197
+#define NUMLEN      10
+
+/* Folded constant: TOK_FOLD, packed double as for TOK_NUM, length of
+   the original expression in two 7-bit bytes (high bit set), original
+   expression tokens.  TOK_FOLDSTR holds a string instead: length (high
+   bit set), characters, then the original expression the same way. */
+#define TOK_FOLD    198
+#define TOK_FOLDSTR 199
+
 /* Error codes - matching original 6502 BASIC */
 #define ERR_NONE         0
 #define ERR_NEXT_NO_FOR  1   /* NF - NEXT without FOR */
@@ -169,21 +210,47 @@ typedef struct var_s var_t;
 typedef struct array_s array_t;
 typedef struct string_s string_t;
 
-/* String descriptor - 3 bytes like original */
+/* String descriptor - immutable once built, shared by reference count.
+   A substring is a view: ptr points into its base string's buffer and
+   the view holds a reference to the base.  Views are not terminated.
+   Buffers live in string space and move when it is collected, except
+   that strings of up to STRSHORT characters are kept in the descriptor. */
+#define STRSHORT 8
 struct string_s {
     int len;            /* String length */
     char *ptr;          /* Pointer to string data */
+    int refs;           /* Number of holders */
+    string_t *base;     /* String owning the buffer, NULL if this one */
+    int off;            /* Offset of a view into its base */
+    int size;           /* Bytes of string space held by an owner */
+    string_t *next;     /* Next owner, view or free descriptor */
+    string_t *prev;     /* Previous owner or view */
+    char sbuf[STRSHORT+1]; /* Text of a short string */
+};
+
+/* Scratch space for string temporaries - a statement's worth */
+#define TMPSPACE 2048
+#define TMPALIGN(n) (((n) + sizeof(char *) - 1) / sizeof(char *) * \
+                     sizeof(char *))
+
+/* Block of string descriptors */
+#define STRCHUNK 64
+typedef struct strchunk_s strchunk_t;
+struct strchunk_s {
+    strchunk_t *next;   /* Next block */
+    string_t desc[STRCHUNK];
 };
 
 /* Variable entry - 6 bytes like original (2 name + 4 value) */
 struct var_s {
     char name[NAMLEN+1]; /* Variable name (2 chars + null) */
-    int type;            /* Data type (TYPE_NUM or TYPE_STR) */
+    int type;            /* Data type (TYPE_NUM, TYPE_STR or TYPE_INT) */
     union {
         double numval;   /* Numeric value */
         string_t *strval; /* String pointer */
+        short intval;    /* Integer value */
     } value;
-    var_t *next;         /* Next in list */
+    var_t *next;         /* Next live variable */
 };
 
 /* Array descriptor */
@@ -192,10 +259,12 @@ struct array_s {
     int type;            /* Element type */
     int ndims;           /* Number of dimensions */
     int dims[11];        /* Dimension sizes (max 11 in original) */
+    int stride[11];      /* Elements between successive indices */
     int size;            /* Total elements */
     union {
         double *numdata;     /* Numeric array data */
         string_t **strdata;  /* String array data */
+        short *intdata;      /* Integer array data */
     } data;
     array_t *next;       /* Next array */
 };
@@ -204,6 +273,7 @@ struct array_s {
 struct line_s {
     int linenum;        /* Line number */
     int len;            /* Line length including header */
+    int eol;            /* Offset of the terminating zero in text */
     unsigned char text[1]; /* Tokenized text (flexible array) */
 };
 
@@ -211,9 +281,10 @@ struct line_s {
 typedef struct {
     int linenum;        /* Line number of FOR */
     unsigned char *txtptr; /* Position after FOR */
-    char varname[NAMLEN+1]; /* Loop variable name */
+    double *varptr;     /* Loop variable storage */
     double limit;       /* TO value */
     double step;        /* STEP value */
+    int down;           /* Nonzero if STEP is negative */
     line_t *line_ptr;   /* Pointer to line for fast return */
 } forstack_t;
 
@@ -226,10 +297,17 @@ typedef struct {
 
 /* DATA pointer state */
 typedef struct {
-    int linenum;        /* Current DATA line */
-    unsigned char *ptr; /* Current position in DATA */
+    int item;           /* Next item in datatab to READ */
 } dataptr_t;
 
+/* DATA item, indexed in program order */
+typedef struct {
+    int linenum;        /* Line holding the item */
+    unsigned char *text; /* Text for a string READ */
+    int len;            /* Length of text */
+    double num;         /* Value for a numeric READ */
+} dataitem_t;
+
 /* Global interpreter state */
 typedef struct {
     /* Memory pointers - like 6502 page zero */
@@ -245,10 +323,33 @@ typedef struct {
     unsigned char *txtptr;  /* Current text pointer */
     line_t *curline_ptr;    /* Pointer to current line */
 
+    /* Line number index - sorted, rebuilt when stale */
+    line_t **linetab;       /* Lines in program order */
+    int nlines;             /* Number of entries in linetab */
+    int linetab_ok;         /* 0 if program changed since built */
+
+    /* DATA index */
+    dataitem_t *datatab;    /* DATA items in program order */
+    int ndata;              /* Number of entries in datatab */
+    int datatab_ok;         /* 0 if program changed since built */
+
     /* Variable storage */
-    var_t *varlist;         /* Variable list head */
+    var_t *varslot[VAR_SLOTS]; /* Variables indexed by var_slot() */
+    var_t *varlist;         /* List of live variables */
+    array_t *aryslot[VAR_SLOTS]; /* Arrays found so far, by slot */
     array_t *arrlist;       /* Array list head */
 
+    /* String space - owners run oldest (nearest memsiz) to newest */
+    string_t *strhead;      /* Oldest string owning space */
+    string_t *strtail;      /* Newest string owning space */
+    string_t *strviews;     /* Substring views into owners */
+    string_t *strfree;      /* Recycled descriptors */
+    strchunk_t *strchunks;  /* Descriptor blocks */
+    char *tmpspace;         /* Scratch space for temporaries */
+    int tmptop;             /* Bytes of it in use */
+    string_t *tmpviews;     /* Temporaries viewing string space */
+    string_t *tmpspill;     /* Temporaries that overflowed into it */
+
     /* Control stacks */
     forstack_t forstack[26];   /* FOR loop stack (A-Z variables) */
     int forsp;                  /* FOR stack pointer */
@@ -291,6 +392,20 @@ int main(int argc, char **argv);
 void init_state();
 void cleanup();
 
+/* output.c */
+void out_init();
+void out_flush();
+void out_text(const char *p, int n);
+void out_str(const char *s);
+void out_char(int c);
+void out_spaces(int n);
+void out_newline();
+void out_number(double x);
+
+/* number.c */
+int fmt_number(char *buf, double x);
+int scan_number(const char *p, int n, double *val);
+
 /* repl.c */
 void repl();
 void execute_direct(char *line);
@@ -301,11 +416,17 @@ int save_file(const char *filename);
 unsigned char *tokenize_line(const char *line, int *len);
 char *detokenize_line(unsigned char *tokens);
 int is_keyword(const char *word);
+unsigned char *skip_token(unsigned char *p);
+void pack_number(unsigned char *p, double num);
+
+/* fold.c */
+unsigned char *fold_line(unsigned char *tokens, int *len);
 
 /* parse.c */
 void insert_line(int linenum, unsigned char *tokens, int len);
 void delete_line(int linenum);
 line_t *find_line(int linenum);
+void index_lines();
 void list_program(int start, int end);
 void new_program();
 
@@ -313,8 +434,108 @@ void new_program();
 void run_program(int startline);
 void execute_statement();
 void skip_to_eol();
+unsigned char *line_end();
+
+/* Statement code opcodes, compiled by vm.c */
+#define OP_HALT     0   /* End of statement */
+#define OP_NUM      1   /* Push constant */
+#define OP_VAR      2   /* Push numeric variable */
+#define OP_ARR      3   /* Pop arg subscripts, push array element */
+#define OP_NEG      4   /* Unary minus */
+#define OP_NOT      5   /* NOT */
+#define OP_ADD      6
+#define OP_SUB      7
+#define OP_MUL      8
+#define OP_DIV      9
+#define OP_POW      10
+#define OP_REL      11  /* Relational operator, arg = relation */
+#define OP_AND      12
+#define OP_OR       13
+#define OP_FN       14  /* Numeric function, arg = token */
+#define OP_LET      15  /* Pop into variable */
+#define OP_ELEM     16  /* Pop arg subscripts, address register = element */
+#define OP_STORE    17  /* Pop into address register */
+#define OP_GOTO     18  /* Jump to resolved line */
+#define OP_GOTOX    19  /* Pop line number and jump */
+#define OP_GOSUB    20  /* Call resolved line */
+#define OP_GOSUBX   21  /* Pop line number and call */
+#define OP_GOSCHK   22  /* Check GOSUB stack space */
+#define OP_RETURN   23
+#define OP_FORCHK   24  /* Check FOR stack space */
+#define OP_FOR      25  /* Pop step and limit, push FOR entry */
+#define OP_NEXT     26
+#define OP_IF       27  /* Pop condition, skip to end of line if false */
+#define OP_THEN     28  /* Interpret rest of line from arg */
+#define OP_END      29
+#define OP_INUM     30  /* Push integer constant arg */
+#define OP_IVAR     31  /* Push integer variable */
+#define OP_IARR     32  /* Pop arg subscripts, push integer element */
+#define OP_FLT      33  /* Integer to number, top of stack */
+#define OP_FLT2     34  /* Integer to number, second on stack */
+#define OP_CINT     35  /* Number to integer as a % variable holds it */
+#define OP_IADD     36
+#define OP_ISUB     37
+#define OP_IMUL     38
+#define OP_INEG     39
+#define OP_IREL     40  /* Integer relation, arg = relation */
+#define OP_INOT     41
+#define OP_IAND     42
+#define OP_IOR      43
+#define OP_ILET     44  /* Pop into integer variable */
+#define OP_IELEM    45  /* Pop arg subscripts, iaddr = integer element */
+#define OP_ISTORE   46  /* Pop into integer address register */
+#define OP_IIF      47  /* Pop integer condition */
+#define OP_PRNUM    48  /* Pop and print number */
+#define OP_PRSTR    49  /* Print arg characters of program text */
+#define OP_PRCOMMA  50  /* Move to next print zone */
+#define OP_PRTAB    51  /* Pop column, TAB (arg 0) or SPC (arg 1) */
+#define OP_PRNL     52  /* End the printed line */
+#define OP_ON       53  /* Pop index, GOTO one of the next arg lines */
+#define OP_ONGOSUB  54  /* Pop index, GOSUB one of the next arg lines */
+
+/* Subscript count and kinds packed in the arg of OP_ARR and friends */
+#define SUB_COUNT(arg)  ((arg) & 15)
+#define SUB_INT(arg, i) (((arg) >> (4 + (i))) & 1)
+
+/* Evaluation stack cell */
+typedef union {
+    double num;                 /* Floating point */
+    long i;                     /* Integer */
+} vmcell_t;
+
+/* Instruction */
+typedef struct {
+    int op;
+    int arg;
+    union {
+        double num;             /* OP_NUM */
+        var_t *var;             /* OP_VAR, OP_LET, OP_FOR, OP_NEXT */
+        line_t *line;           /* OP_GOTO, OP_GOSUB, OP_ON targets */
+        unsigned char *text;    /* OP_PRSTR */
+        int slot;               /* OP_ARR, OP_ELEM, OP_IARR, OP_IELEM */
+    } u;
+} vminsn_t;
+
+/* vm.c */
+int vm_execute();
+void vm_flush();
+double vm_fn(int token, double x);
+vmcell_t *vm_indices(vmcell_t *sp, int arg, int *indices);
+#if HAVE_JIT
+void vm_unjit();
+#endif
+
+/* jit.c */
+#if HAVE_JIT
+typedef void (*jitfn_t)();
+void jit_enable(int on);
+jitfn_t jit_compile(vminsn_t *insn);
+void jit_flush();
+#endif
 
 /* eval.c */
+void eval_init();
+int scan_binop(const unsigned char *p, int *prec, int *op);
 double eval_expr();
 double eval_numeric();
 string_t *eval_string();
@@ -324,14 +545,23 @@ int peek_char();
 void skip_spaces();
 int match_token(int token);
 string_t *parse_string_literal();
+double parse_number();
+int get_varref();
+double get_numlit();
 int get_valtype();
 
 /* variables.c */
+int var_slot(const char *name);
+void slot_name(int slot, char *name);
+var_t *slot_variable(int slot, int create);
 var_t *find_variable(const char *name, int create);
 void set_num_variable(const char *name, double val);
 void set_str_variable(const char *name, string_t *val);
 double get_num_variable(const char *name);
 string_t *get_str_variable(const char *name);
+int int_value(double x);
+double var_num(var_t *var);
+void set_var_num(var_t *var, double x);
 void clear_variables();
 
 /* arrays.c */
@@ -339,13 +569,27 @@ array_t *find_array(const char *name, int create);
 void dimension_array(const char *name, int *dims, int ndims, int type);
 double *array_num_element(const char *name, int *indices, int nindices);
 string_t **array_str_element(const char *name, int *indices, int nindices);
+array_t *slot_array(int slot, int create);
+double *array_num_at(array_t *arr, int *indices, int nindices);
+short *array_int_at(array_t *arr, int *indices, int nindices);
+string_t **array_str_at(array_t *arr, int *indices, int nindices);
 void clear_arrays();
 
 /* strings.c */
 string_t *alloc_string(int len);
 void free_string(string_t *str);
 string_t *copy_string(string_t *src);
+string_t *keep_string(string_t *s);
+string_t *sub_string(string_t *s, int start, int len);
+string_t *temp_string(int len);
+string_t *temp_cstr(const char *cstr);
+int temp_mark();
+void temp_release(int mark);
+string_t *temp_keep(int mark, string_t *s);
+void collect_strings();
+void release_strings();
 string_t *concat_strings(string_t *s1, string_t *s2);
+string_t *append_string(string_t *s, string_t *add);
 int compare_strings(string_t *s1, string_t *s2);
 string_t *string_from_cstr(const char *cstr);
 char *string_to_cstr(string_t *str);
@@ -378,6 +622,8 @@ void do_get();
 void do_on();
 void do_def();
 void do_clear();
+void flush_targets();
+void index_data();
 
 /* functions.c */
 double fn_sgn(double x);
@@ -66,8 +66,7 @@ init_state()
     g_state->gosubsp = 0;
 
     /* Initialize DATA pointer */
-    g_state->dataptr.linenum = 0;
-    g_state->dataptr.ptr = NULL;
+    g_state->dataptr.item = 0;
 
     /* Initialize random seed */
     g_state->rndseed = 12345L;
@@ -76,9 +75,32 @@ init_state()
     g_state->varlist = NULL;
     g_state->arrlist = NULL;
 
+    /* No line index yet */
+    g_state->linetab = NULL;
+    g_state->nlines = 0;
+    g_state->linetab_ok = 0;
+    g_state->datatab = NULL;
+    g_state->ndata = 0;
+    g_state->datatab_ok = 0;
+
+    /* Scratch space for string temporaries */
+    g_state->tmpspace = (char *)malloc(TMPSPACE);
+    if (!g_state->tmpspace) {
+        fprintf(stderr, "Out of memory\n");
+        free(mem);
+        free(g_state);
+        exit(1);
+    }
+    g_state->tmptop = 0;
+    g_state->tmpviews = NULL;
+    g_state->tmpspill = NULL;
+
     /* Terminal position */
     g_state->trmpos = 0;
 
+    /* Operator table for the evaluator */
+    eval_init();
+
     /* Not running */
     g_state->running = 0;
     g_state->errnum = ERR_NONE;
@@ -97,11 +119,28 @@ cleanup()
         /* Free arrays */
         clear_arrays();
 
+        /* Free string descriptors and scratch space */
+        temp_release(0);
+        release_strings();
+        if (g_state->tmpspace) {
+            free(g_state->tmpspace);
+        }
+
         /* Free program memory */
         if (g_state->txttab) {
             free(g_state->txttab);
         }
 
+        /* Free line index */
+        if (g_state->linetab) {
+            free(g_state->linetab);
+        }
+
+        /* Free DATA index */
+        if (g_state->datatab) {
+            free(g_state->datatab);
+        }
+
         /* Free state */
         free(g_state);
         g_state = NULL;
@@ -114,11 +153,14 @@ cleanup()
 static void
 print_banner()
 {
-    printf("MICROSOFT BASIC 6502\n");
-    printf("VERSION 1.1\n");
-    printf("(C) COPYRIGHT 1976-1978 MICROSOFT\n");
-    printf("C PORT (C) 2025 ANDY TAYLOR\n");
-    printf("%ld BYTES FREE\n\n", (long)(g_state->memsiz - g_state->txttab));
+    char buf[32];
+
+    out_str("MICROSOFT BASIC 6502\n");
+    out_str("VERSION 1.1\n");
+    out_str("(C) COPYRIGHT 1976-1978 MICROSOFT\n");
+    out_str("C PORT (C) 2025 ANDY TAYLOR\n");
+    sprintf(buf, "%ld BYTES FREE\n\n", (long)(g_state->memsiz - g_state->txttab));
+    out_str(buf);
 }
 
 /*
@@ -129,16 +171,30 @@ main(argc, argv)
 int argc;
 char **argv;
 {
+    int i;
+
     /* Initialize interpreter */
     init_state();
+    out_init();
 
     /* Print banner */
     print_banner();
 
+    /* -j translates hot statements to native code where possible */
+    i = 1;
+    if (i < argc && strcmp(argv[i], "-j") == 0) {
+#if HAVE_JIT
+        jit_enable(1);
+#endif
+        i++;
+    }
+
     /* Load file if specified on command line */
-    if (argc > 1) {
-        if (load_file(argv[1]) == 0) {
-            printf("LOADED %s\n", argv[1]);
+    if (i < argc) {
+        if (load_file(argv[i]) == 0) {
+            out_str("LOADED ");
+            out_str(argv[i]);
+            out_newline();
         }
     }
 
@@ -146,6 +202,7 @@ char **argv;
     repl();
 
     /* Cleanup */
+    out_flush();
     cleanup();
 
     return 0;
@@ -0,0 +1,227 @@
+/*
+ * number.c - Decimal number conversion
+ *
+ * Microsoft BASIC 6502 C Port
+ * K&R C v2 compatible
+ */
+
+#include "m6502basic.h"
+
+/* Powers of ten that are exact in a double */
+static double tens[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8,
+    1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16
+};
+
+/*
+ * Multiply x by ten to the power k
+ */
+static double
+scale10(x, k)
+double x;
+int k;
+{
+    while (k > 16) {
+        x *= 1e16;
+        k -= 16;
+    }
+    while (k < -16) {
+        x /= 1e16;
+        k += 16;
+    }
+    if (k < 0) {
+        return x / tens[-k];
+    }
+    return x * tens[k];
+}
+
+/*
+ * Format a number the way BASIC prints it: a leading space or minus
+ * sign, up to 9 significant digits with trailing zeros dropped, no
+ * leading zero before the point, and E notation outside .01 to
+ * 999999999.  Writes at most NUMBUFLEN-1 characters plus a NUL and
+ * returns the length.
+ */
+int
+fmt_number(buf, x)
+char *buf;
+double x;
+{
+    char digits[10];
+    char *p;
+    long d;
+    int e, be, nd, i;
+    double m;
+
+    p = buf;
+    if (x < 0) {
+        *p++ = '-';
+        x = -x;
+    } else {
+        *p++ = ' ';
+    }
+
+    if (x == 0) {
+        *p++ = '0';
+        *p = '\0';
+        return (int)(p - buf);
+    }
+    if (x != x || x - x != 0) {
+        /* Not a finite number - only reachable on IEEE hosts */
+        strcpy(p, x != x ? "NAN" : "INF");
+        return (int)(p - buf) + 3;
+    }
+
+    /* Nine digits d with x = d * 10^(e-8), 10^8 <= d < 10^9 */
+    frexp(x, &be);
+    e = (int)floor((be - 1) * 0.30102999566398);
+    for (i = 0; i < 3; i++) {
+        m = scale10(x, 8 - e);
+        d = (long)(m + 0.5);
+        if (d >= 1000000000L) {
+            e++;
+        } else if (d < 100000000L) {
+            e--;
+        } else {
+            break;
+        }
+    }
+    if (d >= 1000000000L) {
+        d = 100000000L;
+    }
+
+    for (i = 8; i >= 0; i--) {
+        digits[i] = (char)('0' + d % 10);
+        d /= 10;
+    }
+    for (nd = 9; nd > 1 && digits[nd - 1] == '0'; nd--)
+        ;
+
+    if (e < -2 || e > 8) {
+        *p++ = digits[0];
+        if (nd > 1) {
+            *p++ = '.';
+            for (i = 1; i < nd; i++) {
+                *p++ = digits[i];
+            }
+        }
+        *p++ = 'E';
+        if (e < 0) {
+            *p++ = '-';
+            e = -e;
+        } else {
+            *p++ = '+';
+        }
+        if (e >= 100) {
+            *p++ = (char)('0' + e / 100);
+            e %= 100;
+        }
+        *p++ = (char)('0' + e / 10);
+        *p++ = (char)('0' + e % 10);
+    } else if (e < 0) {
+        *p++ = '.';
+        for (i = e + 1; i < 0; i++) {
+            *p++ = '0';
+        }
+        for (i = 0; i < nd; i++) {
+            *p++ = digits[i];
+        }
+    } else {
+        for (i = 0; i <= e; i++) {
+            *p++ = i < nd ? digits[i] : '0';
+        }
+        if (nd > e + 1) {
+            *p++ = '.';
+            for (; i < nd; i++) {
+                *p++ = digits[i];
+            }
+        }
+    }
+
+    *p = '\0';
+    return (int)(p - buf);
+}
+
+/*
+ * Read a decimal number from text: optional blanks and sign, digits
+ * with an optional point, and an optional E exponent with its own
+ * sign.  At most n characters are looked at, or up to the NUL if n
+ * is negative.  Stores the value in *val and returns the number of
+ * characters used, 0 if there was no number.
+ */
+int
+scan_number(p, n, val)
+const char *p;
+int n;
+double *val;
+{
+    double m;
+    int i, start, digits, scale, e, esign, neg;
+
+    i = 0;
+    while ((n < 0 || i < n) && (p[i] == ' ' || p[i] == '\t')) {
+        i++;
+    }
+    neg = 0;
+    if ((n < 0 || i < n) && (p[i] == '+' || p[i] == '-')) {
+        neg = (p[i] == '-');
+        i++;
+    }
+
+    /* Digits past the fifteenth only move the point */
+    start = i;
+    m = 0;
+    digits = 0;
+    scale = 0;
+    while ((n < 0 || i < n) && IS_DIGIT(p[i])) {
+        if (digits < 15) {
+            m = m * 10 + (p[i] - '0');
+            if (m != 0) {
+                digits++;
+            }
+        } else {
+            scale++;
+        }
+        i++;
+    }
+    if ((n < 0 || i < n) && p[i] == '.') {
+        i++;
+        while ((n < 0 || i < n) && IS_DIGIT(p[i])) {
+            if (digits < 15) {
+                m = m * 10 + (p[i] - '0');
+                if (m != 0) {
+                    digits++;
+                }
+                scale--;
+            }
+            i++;
+        }
+    }
+    if (i == start || (i == start + 1 && p[start] == '.')) {
+        *val = 0.0;
+        return 0;
+    }
+
+    if ((n < 0 || i < n) && (p[i] == 'E' || p[i] == 'e')) {
+        i++;
+        esign = 1;
+        if ((n < 0 || i < n) && (p[i] == '+' || p[i] == '-')) {
+            esign = (p[i] == '-') ? -1 : 1;
+            i++;
+        }
+        e = 0;
+        while ((n < 0 || i < n) && IS_DIGIT(p[i])) {
+            if (e < 1000) {
+                e = e * 10 + (p[i] - '0');
+            }
+            i++;
+        }
+        scale += esign * e;
+    }
+
+    if (m != 0 && scale != 0) {
+        m = scale10(m, scale);
+    }
+    *val = neg ? -m : m;
+    return i;
+}
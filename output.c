@@ -0,0 +1,187 @@
+/*
+ * output.c - Console output
+ *
+ * Microsoft BASIC 6502 C Port
+ * K&R C v2 compatible
+ */
+
+#include "m6502basic.h"
+
+#if PLATFORM_211BSD
+extern int isatty();
+#else
+#include <unistd.h>
+#endif
+
+/*
+ * Everything written to the console is collected here and handed to
+ * stdio in one fwrite when the buffer fills, before input is read, at
+ * the end of each line when the console is a terminal, and at exit.
+ * The terminal column (trmpos) is kept up to date as text goes by.
+ */
+static char outbuf[OUTBUFSIZ];
+static int outlen;
+static int interactive;
+
+/*
+ * Decide the flush policy from what stdout is
+ */
+void
+out_init()
+{
+    outlen = 0;
+    interactive = isatty(fileno(stdout));
+}
+
+/*
+ * Write out everything buffered
+ */
+void
+out_flush()
+{
+    if (outlen > 0) {
+        fwrite(outbuf, 1, outlen, stdout);
+        outlen = 0;
+    }
+    fflush(stdout);
+}
+
+/*
+ * Output n bytes of text
+ */
+void
+out_text(p, n)
+const char *p;
+int n;
+{
+    const char *q;
+    int chunk, newline;
+
+    if (n <= 0) {
+        return;
+    }
+
+    /* Column counts from the last newline, if there is one */
+    for (q = p + n; q > p && q[-1] != '\n'; q--)
+        ;
+    newline = (q > p);
+    if (newline) {
+        g_state->trmpos = (int)(p + n - q);
+    } else {
+        g_state->trmpos += n;
+    }
+
+    while (n > 0) {
+        if (outlen == OUTBUFSIZ) {
+            fwrite(outbuf, 1, outlen, stdout);
+            outlen = 0;
+        }
+        chunk = OUTBUFSIZ - outlen;
+        if (chunk > n) {
+            chunk = n;
+        }
+        memcpy(outbuf + outlen, p, chunk);
+        outlen += chunk;
+        p += chunk;
+        n -= chunk;
+    }
+
+    if (newline && interactive) {
+        out_flush();
+    }
+}
+
+/*
+ * Output a C string
+ */
+void
+out_str(s)
+const char *s;
+{
+    out_text(s, strlen(s));
+}
+
+/*
+ * Output one character
+ */
+void
+out_char(c)
+int c;
+{
+    if (c == '\n') {
+        out_newline();
+        return;
+    }
+    if (outlen == OUTBUFSIZ) {
+        fwrite(outbuf, 1, outlen, stdout);
+        outlen = 0;
+    }
+    outbuf[outlen++] = c;
+    g_state->trmpos++;
+}
+
+/*
+ * Output n spaces
+ */
+void
+out_spaces(n)
+int n;
+{
+    int chunk;
+
+    if (n <= 0) {
+        return;
+    }
+    g_state->trmpos += n;
+
+    while (n > 0) {
+        if (outlen == OUTBUFSIZ) {
+            fwrite(outbuf, 1, outlen, stdout);
+            outlen = 0;
+        }
+        chunk = OUTBUFSIZ - outlen;
+        if (chunk > n) {
+            chunk = n;
+        }
+        memset(outbuf + outlen, ' ', chunk);
+        outlen += chunk;
+        n -= chunk;
+    }
+}
+
+/*
+ * Output a number as PRINT shows it, with its trailing space
+ */
+void
+out_number(x)
+double x;
+{
+    int n;
+
+    if (OUTBUFSIZ - outlen < NUMBUFLEN) {
+        fwrite(outbuf, 1, outlen, stdout);
+        outlen = 0;
+    }
+    n = fmt_number(outbuf + outlen, x);
+    outbuf[outlen + n++] = ' ';
+    outlen += n;
+    g_state->trmpos += n;
+}
+
+/*
+ * End the line
+ */
+void
+out_newline()
+{
+    if (outlen == OUTBUFSIZ) {
+        fwrite(outbuf, 1, outlen, stdout);
+        outlen = 0;
+    }
+    outbuf[outlen++] = '\n';
+    g_state->trmpos = 0;
+
+    if (interactive) {
+        out_flush();
+    }
+}
@@ -8,28 +8,65 @@
 #include "m6502basic.h"
 
 /*
- * Find a line by number
+ * Build the line number index
+ */
+void
+index_lines()
+{
+    unsigned char *p;
+    line_t **tab;
+    int n;
+
+    /* Count lines */
+    n = 0;
+    for (p = g_state->txttab; p[0] != 0 || p[1] != 0; p += ((line_t *)p)->len) {
+        n++;
+    }
+
+    tab = (line_t **)realloc(g_state->linetab, (n + 1) * sizeof(line_t *));
+    if (!tab) {
+        error(ERR_OUT_OF_MEM);
+        return;
+    }
+    g_state->linetab = tab;
+    g_state->nlines = n;
+
+    n = 0;
+    for (p = g_state->txttab; p[0] != 0 || p[1] != 0; p += ((line_t *)p)->len) {
+        tab[n++] = (line_t *)p;
+    }
+
+    g_state->linetab_ok = 1;
+}
+
+/*
+ * Find a line by number (binary search of the line index)
  */
 line_t *
 find_line(linenum)
 int linenum;
 {
-    unsigned char *p;
-    line_t *line;
+    line_t **tab;
+    int lo, hi, mid;
 
-    p = g_state->txttab;
+    if (!g_state->linetab_ok) {
+        index_lines();
+    }
 
-    while (p[0] != 0 || p[1] != 0) {
-        line = (line_t *)p;
+    tab = g_state->linetab;
+    lo = 0;
+    hi = g_state->nlines - 1;
 
-        if (line->linenum == linenum) {
-            return line;
+    while (lo <= hi) {
+        mid = (lo + hi) / 2;
+        if (tab[mid]->linenum == linenum) {
+            return tab[mid];
         }
-        if (line->linenum > linenum) {
-            return NULL;
+        if (tab[mid]->linenum < linenum) {
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
         }
-
-        p += line->len;
     }
 
     return NULL;
@@ -64,6 +101,13 @@ int linenum;
             g_state->vartab -= linelen;
             g_state->arytab -= linelen;
             g_state->strend -= linelen;
+            g_state->vartab[0] = 0;
+            g_state->vartab[1] = 0;
+
+            g_state->linetab_ok = 0;
+            g_state->datatab_ok = 0;
+            flush_targets();
+            vm_flush();
 
             return;
         }
@@ -87,6 +131,7 @@ int len;
 {
     unsigned char *p;
     unsigned char *insert_point;
+    unsigned char *folded;
     line_t *line;
     int header_size;
     int total_len;
@@ -95,8 +140,14 @@ int len;
     /* First delete any existing line with this number */
     delete_line(linenum);
 
+    /* Store constant subexpressions already evaluated */
+    folded = fold_line(tokens, &len);
+    if (folded) {
+        tokens = folded;
+    }
+
     /* Calculate line structure size */
-    header_size = sizeof(int) + sizeof(int);  /* linenum + len */
+    header_size = sizeof(int) + sizeof(int) + sizeof(int);  /* linenum + len + eol */
 
     /* Word-align for PDP-11 */
 #if IS_16BIT
@@ -110,8 +161,12 @@ int len;
     if (total_len & 1) total_len++;
 #endif
 
-    /* Check if there's room */
-    if (g_state->vartab + total_len >= g_state->fretop) {
+    /* Check if there's room, leaving two bytes for the end marker */
+    if (g_state->fretop - g_state->vartab < total_len + 2) {
+        collect_strings();
+    }
+    if (g_state->fretop - g_state->vartab < total_len + 2) {
+        if (folded) free(folded);
         error(ERR_OUT_OF_MEM);
         return;
     }
@@ -142,12 +197,21 @@ int len;
     line = (line_t *)insert_point;
     line->linenum = linenum;
     line->len = total_len;
+    line->eol = len - 1;
     memcpy(line->text, tokens, len);
+    if (folded) free(folded);
 
     /* Update memory pointers */
     g_state->vartab += total_len;
     g_state->arytab += total_len;
     g_state->strend += total_len;
+    g_state->vartab[0] = 0;
+    g_state->vartab[1] = 0;
+
+    g_state->linetab_ok = 0;
+    g_state->datatab_ok = 0;
+    flush_targets();
+    vm_flush();
 }
 
 /*
@@ -161,6 +225,7 @@ int end;
     unsigned char *p;
     line_t *line;
     char *text;
+    char buf[16];
 
     p = g_state->txttab;
 
@@ -170,7 +235,10 @@ int end;
         if (line->linenum >= start && line->linenum <= end) {
             text = detokenize_line(line->text);
             if (text) {
-                printf("%d %s\n", line->linenum, text);
+                sprintf(buf, "%d ", line->linenum);
+                out_str(buf);
+                out_str(text);
+                out_newline();
                 free(text);
             }
         }
@@ -201,13 +269,16 @@ new_program()
     g_state->vartab = g_state->txttab;
     g_state->arytab = g_state->txttab;
     g_state->strend = g_state->txttab;
-    g_state->fretop = g_state->memsiz;
 
     /* Reset execution state */
     g_state->forsp = 0;
     g_state->gosubsp = 0;
-    g_state->dataptr.linenum = 0;
-    g_state->dataptr.ptr = NULL;
+    g_state->dataptr.item = 0;
     g_state->curlin = -1;
     g_state->running = 0;
+
+    g_state->linetab_ok = 0;
+    g_state->datatab_ok = 0;
+    flush_targets();
+    vm_flush();
 }
@@ -86,8 +86,11 @@ char *line;
     if (setjmp(g_state->errtrap) == 0) {
         execute_statement();
     } else {
+        temp_release(0);
         if (g_state->errnum != ERR_NONE) {
-            printf("?%s\n", error_message(g_state->errnum));
+            out_str("?");
+            out_str(error_message(g_state->errnum));
+            out_newline();
             g_state->errnum = ERR_NONE;
         }
     }
@@ -113,8 +116,9 @@ repl()
     while (1) {
         /* Print prompt */
         if (g_state->curlin == -1 || !g_state->running) {
-            printf("READY.\n");
+            out_str("READY.\n");
         }
+        out_flush();
 
         /* Read line */
         if (fgets(g_state->inputbuf, BUFLEN, stdin) == NULL) {
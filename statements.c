@@ -19,11 +19,8 @@ do_print()
     int newline;
     int tabpos;
     unsigned char *save;
-    char name[NAMLEN+3];
-    int type, i;
-    int indices[11];
-    int nindices;
-    string_t **elem;
+    int is_str;
+    int mark;
 
     newline = 1;
 
@@ -47,10 +44,7 @@ do_print()
         if (c == ',') {
             get_next_char();
             tabpos = ((g_state->trmpos / CLMWID) + 1) * CLMWID;
-            while (g_state->trmpos < tabpos) {
-                putchar(' ');
-                g_state->trmpos++;
-            }
+            out_spaces(tabpos - g_state->trmpos);
             newline = 0;
             continue;
         }
@@ -67,10 +61,7 @@ do_print()
             if (peek_char() == ')') {
                 get_next_char();
             }
-            while (g_state->trmpos < tabpos - 1) {
-                putchar(' ');
-                g_state->trmpos++;
-            }
+            out_spaces(tabpos - 1 - g_state->trmpos);
             newline = 0;
             continue;
         }
@@ -87,105 +78,43 @@ do_print()
             if (peek_char() == ')') {
                 get_next_char();
             }
-            while (tabpos-- > 0) {
-                putchar(' ');
-                g_state->trmpos++;
-            }
+            out_spaces(tabpos);
             newline = 0;
             continue;
         }
 
-        /* String functions - CHR$, STR$, LEFT$, RIGHT$, MID$ */
-        if ((c & 0xFF) == TOK_CHR || (c & 0xFF) == TOK_STR ||
-            (c & 0xFF) == TOK_LEFT || (c & 0xFF) == TOK_RIGHT ||
-            (c & 0xFF) == TOK_MID) {
-            str = eval_string();
-            if (str && str->ptr) {
-                printf("%s", str->ptr);
-                g_state->trmpos += str->len;
-            }
-            if (str) free_string(str);
-            newline = 1;
-            continue;
+        /* String expression - a literal, a string function, a folded
+           string constant or a string variable, possibly joined by + */
+        is_str = (c == '"' || (c & 0xFF) == TOK_CHR ||
+                  (c & 0xFF) == TOK_STR || (c & 0xFF) == TOK_LEFT ||
+                  (c & 0xFF) == TOK_RIGHT || (c & 0xFF) == TOK_MID ||
+                  (c & 0xFF) == TOK_FOLDSTR);
+        if ((c & 0xFF) == TOK_VAR) {
+            /* Look ahead at the variable's type */
+            save = g_state->txtptr;
+            is_str = (SLOT_TYPE(get_varref()) == TYPE_STR);
+            g_state->txtptr = save;
         }
-
-        /* String literal */
-        if (c == '"') {
-            str = parse_string_literal();
-            if (str && str->ptr) {
-                printf("%s", str->ptr);
-                g_state->trmpos += str->len;
+        if (is_str) {
+            /* Temporaries are finished with once printed */
+            mark = temp_mark();
+            str = eval_string();
+            if (str) {
+                out_text(str->ptr, str->len);
             }
-            if (str) free_string(str);
+            temp_release(mark);
             newline = 1;
             continue;
         }
 
-        /* String variable */
-        if (IS_ALPHA(c)) {
-            /* Look ahead for $ */
-            save = g_state->txtptr;
-
-            i = 0;
-            while (IS_ALNUM(peek_char()) && i < NAMLEN) {
-                name[i++] = get_next_char();
-            }
-            name[i] = '\0';
-
-            if (peek_char() == '$') {
-                get_next_char();
-                /* String variable */
-                name[i++] = '$';
-                name[i] = '\0';
-
-                /* Check for array */
-                skip_spaces();
-                if (peek_char() == '(') {
-                    nindices = 0;
-
-                    get_next_char();
-                    while (nindices < 11) {
-                        indices[nindices++] = eval_integer();
-                        skip_spaces();
-                        if (peek_char() == ',') {
-                            get_next_char();
-                        } else {
-                            break;
-                        }
-                    }
-                    skip_spaces();
-                    if (peek_char() == ')') get_next_char();
-
-                    elem = array_str_element(name, indices, nindices);
-                    if (elem && *elem && (*elem)->ptr) {
-                        printf("%s", (*elem)->ptr);
-                        g_state->trmpos += (*elem)->len;
-                    }
-                } else {
-                    str = get_str_variable(name);
-                    if (str && str->ptr) {
-                        printf("%s", str->ptr);
-                        g_state->trmpos += str->len;
-                    }
-                }
-                newline = 1;
-                continue;
-            }
-
-            /* Restore position - it's a numeric expression */
-            g_state->txtptr = save;
-        }
-
         /* Numeric expression */
         num = eval_expr();
-        printf("%g", num);
-        g_state->trmpos += 10;  /* Approximate */
+        out_number(num);
         newline = 1;
     }
 
     if (newline) {
-        printf("\n");
-        g_state->trmpos = 0;
+        out_newline();
     }
 }
 
@@ -195,10 +124,9 @@ do_print()
 void
 do_input()
 {
-    char varname[NAMLEN+3];
     char *line;
     char *p;
-    int type, i;
+    int i;
     double num;
     var_t *var;
     string_t *prompt;
@@ -207,19 +135,18 @@ do_input()
     skip_spaces();
     if (peek_char() == '"') {
         prompt = parse_string_literal();
-        if (prompt && prompt->ptr) {
-            printf("%s", prompt->ptr);
+        if (prompt) {
+            out_text(prompt->ptr, prompt->len);
         }
-        if (prompt) free_string(prompt);
 
         skip_spaces();
         if (peek_char() == ';') {
             get_next_char();
         }
     } else {
-        printf("? ");
+        out_str("? ");
     }
-    fflush(stdout);
+    out_flush();
 
     /* Read input line */
     if (fgets(g_state->inputbuf, BUFLEN, stdin) == NULL) {
@@ -234,35 +161,25 @@ do_input()
     while (1) {
         skip_spaces();
 
-        /* Get variable name */
-        i = 0;
-        type = TYPE_NUM;
-        while (IS_ALNUM(peek_char()) && i < NAMLEN) {
-            varname[i++] = get_next_char();
-        }
-        if (peek_char() == '$') {
-            get_next_char();
-            type = TYPE_STR;
-            varname[i++] = '$';
-        }
-        varname[i] = '\0';
-
-        if (i == 0) break;
+        /* Get variable */
+        if ((peek_char() & 0xFF) != TOK_VAR) break;
+        var = slot_variable(get_varref(), 1);
 
         /* Skip whitespace in input */
         while (*line == ' ' || *line == '\t') line++;
 
         /* Get value */
-        if (type == TYPE_STR) {
+        if (var->type == TYPE_STR) {
             /* Find end of string value */
             p = line;
             while (*p && *p != ',') p++;
             *p = '\0';
-            set_str_variable(varname, string_from_cstr(line));
+            if (var->value.strval) free_string(var->value.strval);
+            var->value.strval = string_from_cstr(line);
             line = (*p) ? p + 1 : p;
         } else {
-            num = atof(line);
-            set_num_variable(varname, num);
+            line += scan_number(line, -1, &num);
+            set_var_num(var, num);
             while (*line && *line != ',') line++;
             if (*line == ',') line++;
         }
@@ -283,38 +200,27 @@ do_input()
 void
 do_let()
 {
-    char varname[NAMLEN+3];
-    int type, i;
+    int type, slot;
     double num;
     string_t *str;
     int indices[11];
     int nindices;
-    char c;
+    var_t *var;
     string_t **str_elem;
     double *num_elem;
+    short *int_elem;
+    unsigned char *save;
+    int c;
 
     skip_spaces();
 
-    /* Get variable name */
-    i = 0;
-    type = TYPE_NUM;
-    while (IS_ALNUM(peek_char()) && i < NAMLEN) {
-        c = get_next_char();
-        if (c >= 'a' && c <= 'z') {
-            varname[i++] = c - 'a' + 'A';
-        } else {
-            varname[i++] = c;
-        }
-    }
-    if (peek_char() == '$') {
-        get_next_char();
-        type = TYPE_STR;
-        varname[i++] = '$';
-    } else if (peek_char() == '%') {
-        get_next_char();
-        type = TYPE_INT;
+    /* Get variable */
+    if ((peek_char() & 0xFF) != TOK_VAR) {
+        syntax_error();
+        return;
     }
-    varname[i] = '\0';
+    slot = get_varref();
+    type = SLOT_TYPE(slot);
 
     /* Check for array subscript */
     skip_spaces();
@@ -348,16 +254,19 @@ do_let()
 
         /* Assign to array element */
         if (type == TYPE_STR) {
-            str_elem = array_str_element(varname, indices, nindices);
+            str_elem = array_str_at(slot_array(slot, 1), indices, nindices);
             str = eval_string();
             if (str_elem) {
+                str = keep_string(str);
                 if (*str_elem) free_string(*str_elem);
                 *str_elem = str;
-            } else if (str) {
-                free_string(str);
             }
+        } else if (type == TYPE_INT) {
+            int_elem = array_int_at(slot_array(slot, 1), indices, nindices);
+            num = eval_expr();
+            if (int_elem) *int_elem = (short)int_value(num);
         } else {
-            num_elem = array_num_element(varname, indices, nindices);
+            num_elem = array_num_at(slot_array(slot, 1), indices, nindices);
             num = eval_expr();
             if (num_elem) *num_elem = num;
         }
@@ -373,13 +282,29 @@ do_let()
             return;
         }
 
+        var = slot_variable(slot, 1);
         if (type == TYPE_STR) {
-            str = eval_string();
-            set_str_variable(varname, str);
-            if (str) free_string(str);
+            /* A$=A$+... extends A$ where it is */
+            skip_spaces();
+            save = g_state->txtptr;
+            if ((peek_char() & 0xFF) == TOK_VAR && get_varref() == slot) {
+                skip_spaces();
+                c = peek_char();
+                if (c == '+' || (c & 0xFF) == TOK_PLUS) {
+                    get_next_char();
+                    str = eval_string();
+                    var->value.strval = append_string(var->value.strval,
+                                                      str);
+                    return;
+                }
+            }
+            g_state->txtptr = save;
+
+            str = keep_string(eval_string());
+            if (var->value.strval) free_string(var->value.strval);
+            var->value.strval = str;
         } else {
-            num = eval_expr();
-            set_num_variable(varname, num);
+            set_var_num(var, eval_expr());
         }
     }
 }
@@ -392,8 +317,6 @@ do_if()
 {
     double condition;
     int c;
-    int depth;
-    int ch;
 
     condition = eval_expr();
 
@@ -408,16 +331,8 @@ do_if()
     }
 
     if (condition == 0.0) {
-        /* False - skip to ELSE or end of line */
-        depth = 1;
-        while (peek_char() != '\0') {
-            ch = peek_char();
-            if ((ch & 0xFF) == TOK_IF) {
-                depth++;
-            }
-            /* Check for ELSE at same depth - not fully implemented in 6502 BASIC */
-            get_next_char();
-        }
+        /* False - skip the rest of the line */
+        skip_to_eol();
         return;
     }
 
@@ -437,18 +352,83 @@ do_if()
     }
 }
 
+/*
+ * Branch target cache - direct mapped on the offset of the line number
+ * text, so a literal GOTO/GOSUB/THEN/ON target is only parsed and
+ * looked up the first time it is executed
+ */
+#define TARGET_CACHE 256
+
+static struct {
+    unsigned int offset;    /* Offset of target text from txttab */
+    unsigned int end;       /* Offset just past the line number */
+    line_t *line;           /* Resolved line, NULL if entry unused */
+} targets[TARGET_CACHE];
+
+/*
+ * Forget all cached branch targets
+ */
+void
+flush_targets()
+{
+    int i;
+
+    for (i = 0; i < TARGET_CACHE; i++) {
+        targets[i].line = NULL;
+    }
+}
+
+/*
+ * Evaluate a branch target at txtptr and find its line
+ * Returns NULL if there is no such line.
+ */
+static line_t *
+target_line()
+{
+    unsigned char *start;
+    unsigned char *p;
+    unsigned int offset;
+    int slot;
+    line_t *line;
+
+    start = g_state->txtptr;
+    if (start < g_state->txttab || start >= g_state->vartab) {
+        return find_line(eval_integer());
+    }
+
+    offset = (unsigned int)(start - g_state->txttab);
+    slot = offset % TARGET_CACHE;
+    if (targets[slot].line && targets[slot].offset == offset) {
+        g_state->txtptr = g_state->txttab + targets[slot].end;
+        return targets[slot].line;
+    }
+
+    line = find_line(eval_integer());
+
+    /* Only plain line numbers can be cached */
+    for (p = start; p < g_state->txtptr; p++) {
+        if (!IS_DIGIT(*p) && *p != ' ' && *p != '\t') {
+            return line;
+        }
+    }
+
+    if (line) {
+        targets[slot].offset = offset;
+        targets[slot].end = (unsigned int)(g_state->txtptr - g_state->txttab);
+        targets[slot].line = line;
+    }
+    return line;
+}
+
 /*
  * GOTO statement
  */
 void
 do_goto()
 {
-    int linenum;
     line_t *line;
 
-    linenum = eval_integer();
-
-    line = find_line(linenum);
+    line = target_line();
     if (!line) {
         error(ERR_UNDEF_STMT);
         return;
@@ -465,7 +445,6 @@ do_goto()
 void
 do_gosub()
 {
-    int linenum;
     line_t *line;
 
     if (g_state->gosubsp >= 26) {
@@ -473,9 +452,7 @@ do_gosub()
         return;
     }
 
-    linenum = eval_integer();
-
-    line = find_line(linenum);
+    line = target_line();
     if (!line) {
         error(ERR_UNDEF_STMT);
         return;
@@ -516,28 +493,26 @@ do_return()
 void
 do_for()
 {
-    char varname[NAMLEN+3];
-    int i;
+    int slot;
+    var_t *var;
     double start, limit, step;
-    char c;
 
     if (g_state->forsp >= 26) {
         error(ERR_OUT_OF_MEM);
         return;
     }
 
-    /* Get variable name */
+    /* Get loop variable - must be numeric */
     skip_spaces();
-    i = 0;
-    while (IS_ALNUM(peek_char()) && i < NAMLEN) {
-        c = get_next_char();
-        if (c >= 'a' && c <= 'z') {
-            varname[i++] = c - 'a' + 'A';
-        } else {
-            varname[i++] = c;
-        }
+    if ((peek_char() & 0xFF) != TOK_VAR) {
+        syntax_error();
+        return;
+    }
+    slot = get_varref();
+    if (SLOT_TYPE(slot) != TYPE_NUM) {
+        syntax_error();
+        return;
     }
-    varname[i] = '\0';
 
     /* Expect = */
     skip_spaces();
@@ -550,7 +525,8 @@ do_for()
 
     /* Get start value */
     start = eval_expr();
-    set_num_variable(varname, start);
+    var = slot_variable(slot, 1);
+    var->value.numval = start;
 
     /* Expect TO */
     skip_spaces();
@@ -573,9 +549,10 @@ do_for()
     g_state->forstack[g_state->forsp].linenum = g_state->curlin;
     g_state->forstack[g_state->forsp].txtptr = g_state->txtptr;
     g_state->forstack[g_state->forsp].line_ptr = g_state->curline_ptr;
-    strcpy(g_state->forstack[g_state->forsp].varname, varname);
+    g_state->forstack[g_state->forsp].varptr = &var->value.numval;
     g_state->forstack[g_state->forsp].limit = limit;
     g_state->forstack[g_state->forsp].step = step;
+    g_state->forstack[g_state->forsp].down = step < 0;
     g_state->forsp++;
 }
 
@@ -585,62 +562,43 @@ do_for()
 void
 do_next()
 {
-    char varname[NAMLEN+3];
-    int i;
-    double current, limit, step;
-    int done;
-    char c;
+    int slot;
+    forstack_t *fp;
+    double *varptr;
+    double current;
 
-    /* Get variable name (optional) */
+    /* Get variable (optional) */
+    varptr = NULL;
     skip_spaces();
-    i = 0;
-    if (IS_ALPHA(peek_char())) {
-        while (IS_ALNUM(peek_char()) && i < NAMLEN) {
-            c = get_next_char();
-            if (c >= 'a' && c <= 'z') {
-                varname[i++] = c - 'a' + 'A';
-            } else {
-                varname[i++] = c;
-            }
-        }
-        varname[i] = '\0';
-    } else {
-        if (g_state->forsp == 0) {
-            error(ERR_NEXT_NO_FOR);
+    if ((peek_char() & 0xFF) == TOK_VAR) {
+        slot = get_varref();
+        if (SLOT_TYPE(slot) != TYPE_NUM) {
+            error(ERR_TYPE_MISM);
             return;
         }
-        strcpy(varname, g_state->forstack[g_state->forsp-1].varname);
+        varptr = &slot_variable(slot, 1)->value.numval;
     }
 
     if (g_state->forsp == 0) {
         error(ERR_NEXT_NO_FOR);
         return;
     }
-
-    /* Get loop info */
-    limit = g_state->forstack[g_state->forsp-1].limit;
-    step = g_state->forstack[g_state->forsp-1].step;
-
-    /* Increment variable */
-    current = get_num_variable(varname);
-    current += step;
-    set_num_variable(varname, current);
-
-    /* Check if done */
-    done = 0;
-    if (step >= 0) {
-        if (current > limit) done = 1;
-    } else {
-        if (current < limit) done = 1;
+    fp = &g_state->forstack[g_state->forsp-1];
+    if (!varptr) {
+        varptr = fp->varptr;
     }
 
-    if (done) {
+    /* Increment variable and check if done */
+    current = *varptr + fp->step;
+    *varptr = current;
+
+    if (fp->down ? current < fp->limit : current > fp->limit) {
         g_state->forsp--;
     } else {
         /* Loop back */
-        g_state->curlin = g_state->forstack[g_state->forsp-1].linenum;
-        g_state->txtptr = g_state->forstack[g_state->forsp-1].txtptr;
-        g_state->curline_ptr = g_state->forstack[g_state->forsp-1].line_ptr;
+        g_state->curlin = fp->linenum;
+        g_state->txtptr = fp->txtptr;
+        g_state->curline_ptr = fp->line_ptr;
     }
 }
 
@@ -652,32 +610,18 @@ do_dim()
 {
     char arrname[NAMLEN+3];
     int dims[11];
-    int ndims, i;
+    int ndims, slot;
     int type;
-    char c;
 
     while (1) {
         skip_spaces();
-        i = 0;
-        type = TYPE_NUM;
-
-        while (IS_ALNUM(peek_char()) && i < NAMLEN) {
-            c = get_next_char();
-            if (c >= 'a' && c <= 'z') {
-                arrname[i++] = c - 'a' + 'A';
-            } else {
-                arrname[i++] = c;
-            }
-        }
-
-        if (peek_char() == '$') {
-            get_next_char();
-            type = TYPE_STR;
-        } else if (peek_char() == '%') {
-            get_next_char();
-            type = TYPE_INT;
+        if ((peek_char() & 0xFF) != TOK_VAR) {
+            syntax_error();
+            return;
         }
-        arrname[i] = '\0';
+        slot = get_varref();
+        type = SLOT_TYPE(slot);
+        slot_name(slot, arrname);
 
         /* Expect ( */
         skip_spaces();
@@ -719,76 +663,124 @@ do_dim()
 }
 
 /*
- * DATA statement - skip during execution
+ * DATA statement - skip during execution, up to a colon outside quotes
  */
 void
 do_data()
 {
-    skip_to_eol();
+    unsigned char *p;
+
+    p = g_state->txtptr;
+    while (*p && *p != ':') {
+        if (*p == '"') {
+            p++;
+            while (*p && *p != '"') p++;
+            if (!*p) break;
+        }
+        p++;
+    }
+    g_state->txtptr = p;
 }
 
 /*
- * Find next DATA item
- * Returns pointer to start of data item, or NULL if no more data
+ * Numeric value of a DATA item, as READ has always converted it
  */
-static unsigned char *
-find_next_data()
+static double
+data_number(p)
+unsigned char *p;
+{
+    double num;
+
+    scan_number((char *)p, -1, &num);
+    return num;
+}
+
+/*
+ * Walk the DATA items of the program, filling tab if it is not NULL
+ * Returns the number of items.
+ */
+static int
+scan_data(tab)
+dataitem_t *tab;
 {
     unsigned char *p;
     unsigned char *text;
+    unsigned char *item;
     line_t *line;
+    int n;
 
-    /* If we have a current position, try to continue from there */
-    if (g_state->dataptr.ptr) {
-        p = g_state->dataptr.ptr;
-
-        /* Skip whitespace */
-        while (*p == ' ' || *p == '\t') p++;
-
-        /* Check for comma (more data on this line) */
-        if (*p == ',') {
-            p++;
-            while (*p == ' ' || *p == '\t') p++;
-            return p;
-        }
+    n = 0;
+    for (p = g_state->txttab; p[0] != 0 || p[1] != 0; p += line->len) {
+        line = (line_t *)p;
 
-        /* End of this DATA line - find next DATA statement */
-        if (*p == '\0') {
-            /* Move to next line */
-            line = (line_t *)((unsigned char *)g_state->dataptr.ptr -
-                   ((unsigned char *)g_state->dataptr.ptr - g_state->txttab) %
-                   sizeof(line_t));
-            /* This is complex - let's restart search from current line */
-            g_state->dataptr.linenum++;
-            g_state->dataptr.ptr = NULL;
-        }
-    }
+        /* Each DATA statement on the line runs to a colon outside quotes */
+        text = line->text;
+        while (1) {
+            while (*text && (*text & 0xFF) != TOK_DATA) {
+                text = skip_token(text);
+            }
+            if (!*text) {
+                break;
+            }
+            text++;
 
-    /* Search for next DATA statement */
-    p = g_state->txttab;
-    while (p[0] != 0 || p[1] != 0) {
-        line = (line_t *)p;
+            while (1) {
+                while (*text == ' ' || *text == '\t') text++;
 
-        if (line->linenum > g_state->dataptr.linenum ||
-            (line->linenum == g_state->dataptr.linenum && g_state->dataptr.ptr == NULL)) {
-            /* Check if this line has DATA */
-            text = line->text;
-            while (*text) {
-                if ((*text & 0xFF) == TOK_DATA) {
+                item = text;
+                if (*text == '"') {
                     text++;
-                    while (*text == ' ' || *text == '\t') text++;
-                    g_state->dataptr.linenum = line->linenum;
-                    g_state->dataptr.ptr = text;
-                    return text;
+                    while (*text && *text != '"') text++;
+                    if (tab) {
+                        tab[n].text = item + 1;
+                        tab[n].len = text - (item + 1);
+                    }
+                } else {
+                    while (*text && *text != ',' && *text != ':') text++;
+                    if (tab) {
+                        tab[n].text = item;
+                        tab[n].len = text - item;
+                    }
+                }
+                if (tab) {
+                    tab[n].linenum = line->linenum;
+                    tab[n].num = data_number(item);
+                }
+                n++;
+
+                while (*text && *text != ',' && *text != ':') text++;
+                if (*text != ',') {
+                    break;
                 }
                 text++;
             }
         }
+    }
 
-        p += line->len;
+    return n;
+}
+
+/*
+ * Build the DATA item index
+ */
+void
+index_data()
+{
+    dataitem_t *tab;
+    int n;
+
+    n = scan_data((dataitem_t *)NULL);
+
+    tab = (dataitem_t *)realloc(g_state->datatab, (n + 1) * sizeof(dataitem_t));
+    if (!tab) {
+        error(ERR_OUT_OF_MEM);
+        return;
     }
+    g_state->datatab = tab;
+    g_state->ndata = scan_data(tab);
+    g_state->dataptr.item = 0;
 
-    return NULL;  /* No more DATA */
+    g_state->datatab_ok = 1;
 }
 
 /*
@@ -797,77 +789,41 @@ find_next_data()
 void
 do_read()
 {
-    char varname[NAMLEN+3];
-    int type;
-    unsigned char *datapos;
-    double numval;
-    char strbuf[256];
-    char numbuf[32];
-    int i;
+    var_t *var;
+    dataitem_t *item;
+    int len;
+
+    if (!g_state->datatab_ok) {
+        index_data();
+    }
 
     while (1) {
-        /* Get variable name */
+        /* Get variable reference */
         skip_spaces();
-        if (!IS_ALPHA(peek_char())) {
+        if ((peek_char() & 0xFF) != TOK_VAR) {
             break;
         }
+        var = slot_variable(get_varref(), 1);
 
-        i = 0;
-        while (IS_ALNUM(peek_char()) && i < NAMLEN) {
-            varname[i++] = get_next_char();
-        }
-        varname[i] = '\0';
-
-        type = TYPE_NUM;
-        if (peek_char() == '$') {
-            get_next_char();
-            varname[i++] = '$';
-            varname[i] = '\0';
-            type = TYPE_STR;
-        }
-
-        /* Find next DATA item */
-        datapos = find_next_data();
-        if (!datapos) {
+        /* Take the next DATA item */
+        if (g_state->dataptr.item >= g_state->ndata) {
             error(ERR_OUT_OF_DATA);
             return;
         }
-
-        /* Parse the data value */
-        if (type == TYPE_STR) {
-            /* String data */
-            i = 0;
-            if (*datapos == '"') {
-                datapos++;
-                while (*datapos && *datapos != '"' && i < 255) {
-                    strbuf[i++] = *datapos++;
-                }
-                if (*datapos == '"') datapos++;
-            } else {
-                while (*datapos && *datapos != ',' && *datapos != '\0' && i < 255) {
-                    strbuf[i++] = *datapos++;
-                }
+        item = &g_state->datatab[g_state->dataptr.item++];
+
+        if (var->type == TYPE_STR) {
+            len = item->len < 255 ? item->len : 255;
+            if (var->value.strval) free_string(var->value.strval);
+            var->value.strval = alloc_string(len);
+            if (var->value.strval && var->value.strval->ptr) {
+                memcpy(var->value.strval->ptr, item->text, len);
+                var->value.strval->ptr[len] = '\0';
             }
-            strbuf[i] = '\0';
-            set_str_variable(varname, string_from_cstr(strbuf));
         } else {
-            /* Numeric data */
-            i = 0;
-            /* Skip leading whitespace */
-            while (*datapos == ' ' || *datapos == '\t') datapos++;
-            /* Parse number */
-            while (*datapos && *datapos != ',' && *datapos != ' ' &&
-                   *datapos != '\t' && *datapos != '\0' && i < 31) {
-                numbuf[i++] = *datapos++;
-            }
-            numbuf[i] = '\0';
-            numval = atof(numbuf);
-            set_num_variable(varname, numval);
+            set_var_num(var, item->num);
         }
 
-        /* Update data pointer */
-        g_state->dataptr.ptr = datapos;
-
         /* Check for more variables */
         skip_spaces();
         if (peek_char() == ',') {
@@ -879,13 +835,43 @@ do_read()
 }
 
 /*
- * RESTORE statement
+ * RESTORE statement - optionally to the first DATA item at or after
+ * a line
  */
 void
 do_restore()
 {
-    g_state->dataptr.linenum = 0;
-    g_state->dataptr.ptr = NULL;
+    int linenum;
+    int lo, hi, mid;
+
+    if (!g_state->datatab_ok) {
+        index_data();
+    }
+
+    skip_spaces();
+    if (!IS_DIGIT(peek_char())) {
+        g_state->dataptr.item = 0;
+        return;
+    }
+
+    linenum = eval_integer();
+    if (!find_line(linenum)) {
+        error(ERR_UNDEF_STMT);
+        return;
+    }
+
+    /* Binary search for the first item on or after the line */
+    lo = 0;
+    hi = g_state->ndata;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (g_state->datatab[mid].linenum < linenum) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    g_state->dataptr.item = lo;
 }
 
 /*
@@ -904,10 +890,13 @@ do_end()
 void
 do_stop()
 {
+    char buf[32];
+
     g_state->running = 0;
     g_state->oldlin = g_state->curlin;
     g_state->oldtxt = g_state->txtptr;
-    printf("BREAK IN %d\n", g_state->curlin);
+    sprintf(buf, "BREAK IN %d\n", g_state->curlin);
+    out_str(buf);
 }
 
 /*
@@ -1012,12 +1001,11 @@ do_load()
     if (!filename) return;
 
     fname = string_to_cstr(filename);
-    free_string(filename);
 
     if (!fname) return;
 
     if (load_file(fname) != 0) {
-        printf("?FILE NOT FOUND\n");
+        out_str("?FILE NOT FOUND\n");
     }
 
     free(fname);
@@ -1036,12 +1024,11 @@ do_save()
     if (!filename) return;
 
     fname = string_to_cstr(filename);
-    free_string(filename);
 
     if (!fname) return;
 
     if (save_file(fname) != 0) {
-        printf("?FILE ERROR\n");
+        out_str("?FILE ERROR\n");
     }
 
     free(fname);
@@ -1081,8 +1068,8 @@ do_get()
 {
     /* Simplified - just skip */
     skip_spaces();
-    while (IS_ALNUM(peek_char()) || peek_char() == '$') {
-        get_next_char();
+    if ((peek_char() & 0xFF) == TOK_VAR) {
+        get_varref();
     }
 }
 
@@ -1093,7 +1080,6 @@ void
 do_on()
 {
     int index;
-    int linenum;
     int i;
     int is_gosub;
     line_t *line;
@@ -1131,10 +1117,16 @@ do_on()
         return;  /* Index out of range */
     }
 
-    linenum = eval_integer();
+    line = target_line();
+
+    /* RETURN comes back after the whole list */
+    skip_spaces();
+    while (IS_DIGIT(peek_char()) || peek_char() == ',') {
+        get_next_char();
+        skip_spaces();
+    }
 
     if (is_gosub) {
-        line = find_line(linenum);
         if (!line) {
             error(ERR_UNDEF_STMT);
             return;
@@ -1154,7 +1146,6 @@ do_on()
         g_state->txtptr = line->text;
         g_state->curline_ptr = line;
     } else {
-        line = find_line(linenum);
         if (!line) {
             error(ERR_UNDEF_STMT);
             return;
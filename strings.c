@@ -7,6 +7,179 @@
 
 #include "m6502basic.h"
 
+/*
+ * String space
+ *
+ * Text lives between the end of the program and memsiz, handed out
+ * downward from fretop.  Strings owning space are kept on a list from
+ * oldest (highest address) to newest, so the collector can slide each
+ * one up against its predecessor in a single pass.  Views into them are
+ * kept on a second list and re-pointed afterwards.  Descriptors are
+ * recycled through a free list rather than returned to malloc, and
+ * short strings are stored in the descriptor itself.
+ *
+ * Strings made while evaluating - literals, function results, joins -
+ * are temporaries.  They come from scratch space that is emptied at the
+ * start of every statement, so nothing frees them one by one and an
+ * error part way through leaks nothing.  eval_string() hands back either
+ * a temporary or a variable's own string; whoever stores the result
+ * takes it with keep_string().  Should a statement fill scratch space,
+ * further temporaries are ordinary strings held on the tmpspill list
+ * until their statement ends.
+ */
+
+/*
+ * Get a descriptor from the free list
+ */
+static string_t *
+new_desc()
+{
+    strchunk_t *chunk;
+    string_t *str;
+    int i;
+
+    if (!g_state->strfree) {
+        chunk = (strchunk_t *)malloc(sizeof(strchunk_t));
+        if (!chunk) {
+            error(ERR_OUT_OF_STR);
+            return NULL;
+        }
+        chunk->next = g_state->strchunks;
+        g_state->strchunks = chunk;
+
+        for (i = 0; i < STRCHUNK; i++) {
+            chunk->desc[i].next = g_state->strfree;
+            g_state->strfree = &chunk->desc[i];
+        }
+    }
+
+    str = g_state->strfree;
+    g_state->strfree = str->next;
+    return str;
+}
+
+/*
+ * Take n bytes of string space, collecting if it has run out
+ */
+static char *
+str_space(n)
+int n;
+{
+    /* Keep the program's two terminating zero bytes clear */
+    if (g_state->fretop - g_state->strend < n + 2) {
+        collect_strings();
+        if (g_state->fretop - g_state->strend < n + 2) {
+            error(ERR_OUT_OF_STR);
+            return NULL;
+        }
+    }
+
+    g_state->fretop -= n;
+    return (char *)g_state->fretop;
+}
+
+/*
+ * Compact string space up against memsiz
+ */
+void
+collect_strings()
+{
+    string_t *str;
+    unsigned char *top;
+
+    /* Oldest first: each moves up, clear of the younger ones below */
+    top = g_state->memsiz;
+    for (str = g_state->strhead; str != NULL; str = str->next) {
+        top -= str->size;
+        if ((char *)top != str->ptr) {
+            memmove(top, str->ptr, str->size);
+            str->ptr = (char *)top;
+        }
+    }
+    g_state->fretop = top;
+
+    for (str = g_state->strviews; str != NULL; str = str->next) {
+        str->ptr = str->base->ptr + str->off;
+    }
+    for (str = g_state->tmpviews; str != NULL; str = str->next) {
+        str->ptr = str->base->ptr + str->off;
+    }
+}
+
+/*
+ * Free the descriptor blocks at exit
+ */
+void
+release_strings()
+{
+    strchunk_t *chunk;
+
+    while (g_state->strchunks) {
+        chunk = g_state->strchunks;
+        g_state->strchunks = chunk->next;
+        free(chunk);
+    }
+    g_state->strfree = NULL;
+    g_state->strhead = NULL;
+    g_state->strtail = NULL;
+    g_state->strviews = NULL;
+    g_state->fretop = g_state->memsiz;
+}
+
+/*
+ * Allocate a string of len characters with room to grow to room
+ */
+static string_t *
+alloc_room(len, room)
+int len;
+int room;
+{
+    string_t *str;
+    char *ptr;
+
+    ptr = NULL;
+    if (room > STRSHORT) {
+        ptr = str_space(room + 1);
+        if (!ptr) {
+            return NULL;
+        }
+        ptr[0] = '\0';
+    }
+
+    str = new_desc();
+    if (!str) {
+        return NULL;
+    }
+
+    if (!ptr && len > 0) {
+        ptr = str->sbuf;
+        ptr[0] = '\0';
+    }
+
+    str->ptr = ptr;
+    str->len = len;
+    str->refs = 1;
+    str->base = NULL;
+    str->off = 0;
+    str->size = 0;
+    str->next = NULL;
+    str->prev = NULL;
+
+    /* Newest string sits at fretop, the tail of the list */
+    if (room > STRSHORT) {
+        str->size = room + 1;
+        str->prev = g_state->strtail;
+        if (g_state->strtail) {
+            g_state->strtail->next = str;
+        } else {
+            g_state->strhead = str;
+        }
+        g_state->strtail = str;
+    }
+
+    return str;
+}
+
 /*
  * Allocate a new string
  */
@@ -14,43 +187,366 @@ string_t *
 alloc_string(len)
 int len;
 {
+    return alloc_room(len, len);
+}
+
+/*
+ * Drop one reference to a string, freeing it with the last
+ */
+void
+free_string(str)
+string_t *str;
+{
+    /* Temporaries go when their statement ends */
+    if (!str || str->refs == 0 || --str->refs > 0) {
+        return;
+    }
+
+    if (str->base) {
+        /* View - unlink and let go of the owner */
+        if (str->prev) {
+            str->prev->next = str->next;
+        } else {
+            g_state->strviews = str->next;
+        }
+        if (str->next) {
+            str->next->prev = str->prev;
+        }
+        free_string(str->base);
+    } else if (str->size > 0) {
+        if (str->prev) {
+            str->prev->next = str->next;
+        } else {
+            g_state->strhead = str->next;
+        }
+        if (str->next) {
+            str->next->prev = str->prev;
+        } else {
+            g_state->strtail = str->prev;
+        }
+
+        /* Newest string gives its space straight back */
+        if ((unsigned char *)str->ptr == g_state->fretop) {
+            g_state->fretop += str->size;
+        }
+        if (!g_state->strhead) {
+            g_state->fretop = g_state->memsiz;
+        }
+    }
+
+    str->next = g_state->strfree;
+    g_state->strfree = str;
+}
+
+/*
+ * Whether scratch space has room for a temporary of len characters
+ */
+static int
+temp_fits(len)
+int len;
+{
+    return TMPALIGN(g_state->tmptop) + (int)sizeof(string_t) + len + 1 <=
+           TMPSPACE;
+}
+
+/*
+ * Temporary of len characters in string space, for when scratch space
+ * is full.  A record on tmpspill holds the one reference; it takes a
+ * byte of position past tmptop, so temp_release() lets go of it along
+ * with the scratch temporaries made after it.
+ */
+static string_t *
+temp_spill(len)
+int len;
+{
+    string_t *rec;
     string_t *str;
 
-    str = (string_t *)malloc(sizeof(string_t));
+    str = alloc_string(len);
     if (!str) {
-        error(ERR_OUT_OF_STR);
+        return NULL;
+    }
+    rec = new_desc();
+    if (!rec) {
+        free_string(str);
         return NULL;
     }
 
-    if (len > 0) {
-        str->ptr = (char *)malloc(len + 1);
-        if (!str->ptr) {
-            free(str);
-            error(ERR_OUT_OF_STR);
-            return NULL;
-        }
-        str->ptr[0] = '\0';
-    } else {
-        str->ptr = NULL;
+    rec->base = str;
+    rec->off = g_state->tmptop++;
+    rec->next = g_state->tmpspill;
+    g_state->tmpspill = rec;
+    return str;
+}
+
+/*
+ * Allocate a temporary string of len characters
+ */
+string_t *
+temp_string(len)
+int len;
+{
+    string_t *str;
+    int top;
+
+    if (len < 0) {
+        error(ERR_STRING_LONG);
+        return NULL;
     }
+    if (!temp_fits(len)) {
+        return temp_spill(len);
+    }
+    top = TMPALIGN(g_state->tmptop);
+    g_state->tmptop = top + sizeof(string_t) + len + 1;
 
+    /* Text follows the descriptor */
+    str = (string_t *)(g_state->tmpspace + top);
     str->len = len;
+    str->ptr = len > 0 ? (char *)(str + 1) : NULL;
+    str->refs = 0;
+    str->base = NULL;
+    str->off = 0;
+    str->size = 0;
+    str->next = NULL;
+    str->prev = NULL;
+    if (str->ptr) {
+        str->ptr[0] = '\0';
+    }
     return str;
 }
 
 /*
- * Free a string
+ * Temporary copy of a C string
+ */
+string_t *
+temp_cstr(cstr)
+const char *cstr;
+{
+    string_t *str;
+    int len;
+
+    len = strlen(cstr);
+    if (len > 255) {
+        len = 255;
+    }
+
+    str = temp_string(len);
+    if (str && len > 0) {
+        memcpy(str->ptr, cstr, len);
+        str->ptr[len] = '\0';
+    }
+    return str;
+}
+
+/*
+ * Position in scratch space, for temp_release()
+ */
+int
+temp_mark()
+{
+    return g_state->tmptop;
+}
+
+/*
+ * Discard the temporaries made since mark; temp_release(0) empties
+ * scratch space for the next statement
  */
 void
-free_string(str)
-string_t *str;
+temp_release(mark)
+int mark;
+{
+    string_t *view;
+    string_t *rec;
+
+    /* Views were pushed in the order made, so the newest are first */
+    while (g_state->tmpviews &&
+           (char *)g_state->tmpviews >= g_state->tmpspace + mark) {
+        view = g_state->tmpviews;
+        g_state->tmpviews = view->next;
+        free_string(view->base);
+    }
+
+    /* So were the temporaries spilled to string space */
+    while (g_state->tmpspill && g_state->tmpspill->off >= mark) {
+        rec = g_state->tmpspill;
+        g_state->tmpspill = rec->next;
+        free_string(rec->base);
+        rec->next = g_state->strfree;
+        g_state->strfree = rec;
+    }
+    g_state->tmptop = mark;
+}
+
+/*
+ * Discard the temporaries made since mark except s, which moves down
+ * to mark - keeps a long chain of joins within scratch space
+ */
+string_t *
+temp_keep(mark, s)
+int mark;
+string_t *s;
+{
+    string_t *str;
+    string_t *rec;
+    string_t **link;
+    char *text;
+    int len, top;
+
+    /* Only a temporary holding its own text can move */
+    if (s && (s->refs > 0 || s->base)) {
+        if (s->refs > 0) {
+            /* A spilled temporary keeps its record, moved down to mark */
+            link = &g_state->tmpspill;
+            while (*link && (*link)->off >= mark && (*link)->base != s) {
+                link = &(*link)->next;
+            }
+            rec = *link;
+            if (rec && rec->off >= mark) {
+                *link = rec->next;
+            } else {
+                rec = NULL;
+            }
+            temp_release(mark);
+            if (rec) {
+                rec->off = g_state->tmptop++;
+                rec->next = g_state->tmpspill;
+                g_state->tmpspill = rec;
+            }
+        }
+        return s;
+    }
+    if (!s || (char *)s < g_state->tmpspace + mark) {
+        temp_release(mark);
+        return s;
+    }
+
+    len = s->len;
+    text = s->ptr;
+    temp_release(mark);
+
+    /* Text first: the new descriptor may lie over the old text */
+    top = TMPALIGN(mark);
+    str = (string_t *)(g_state->tmpspace + top);
+    if (len > 0) {
+        memmove((char *)(str + 1), text, len);
+    }
+    g_state->tmptop = top + sizeof(string_t) + len + 1;
+
+    str->len = len;
+    str->ptr = len > 0 ? (char *)(str + 1) : NULL;
+    str->refs = 0;
+    str->base = NULL;
+    str->off = 0;
+    str->size = 0;
+    str->next = NULL;
+    str->prev = NULL;
+    if (str->ptr) {
+        str->ptr[len] = '\0';
+    }
+    return str;
+}
+
+/*
+ * Take a string to store in a variable or array element - shares a
+ * string something already holds, and moves a temporary out of scratch
+ * space
+ */
+string_t *
+keep_string(s)
+string_t *s;
 {
-    if (str) {
-        if (str->ptr) {
-            free(str->ptr);
+    string_t *str;
+
+    if (!s) {
+        return alloc_string(0);
+    }
+    if (s->refs > 0) {
+        s->refs++;
+        return s;
+    }
+
+    /* A long slice of a string stays a view of it */
+    if (s->base && s->len > STRSHORT) {
+        str = new_desc();
+        if (!str) {
+            return NULL;
+        }
+        s->base->refs++;
+
+        str->len = s->len;
+        str->ptr = s->ptr;
+        str->refs = 1;
+        str->base = s->base;
+        str->off = s->off;
+        str->size = 0;
+
+        str->prev = NULL;
+        str->next = g_state->strviews;
+        if (str->next) {
+            str->next->prev = str;
         }
-        free(str);
+        g_state->strviews = str;
+        return str;
+    }
+
+    /* Scratch space text does not move if this collects */
+    str = alloc_string(s->len);
+    if (str && s->len > 0) {
+        memcpy(str->ptr, s->ptr, s->len);
+        str->ptr[s->len] = '\0';
     }
+    return str;
+}
+
+/*
+ * Temporary of len characters from start of s, sharing its text
+ */
+string_t *
+sub_string(s, start, len)
+string_t *s;
+int start;
+int len;
+{
+    string_t *view;
+    string_t *base;
+
+    if (len <= 0) {
+        return temp_string(0);
+    }
+    if (start == 0 && len == s->len) {
+        return s;
+    }
+
+    /* A short piece is cheaper copied than pinning the whole */
+    if (len <= STRSHORT) {
+        view = temp_string(len);
+        memcpy(view->ptr, s->ptr + start, len);
+        view->ptr[len] = '\0';
+        return view;
+    }
+
+    /* With scratch space full, a copy is the only kind of temporary */
+    if (!temp_fits(0)) {
+        view = temp_string(len);
+        memcpy(view->ptr, s->ptr + start, len);
+        view->ptr[len] = '\0';
+        return view;
+    }
+
+    view = temp_string(0);
+    view->len = len;
+    view->ptr = s->ptr + start;
+
+    /* Text in scratch space stays put; string space text may move */
+    base = s->base ? s->base : (s->refs > 0 ? s : NULL);
+    if (base) {
+        base->refs++;
+        view->base = base;
+        view->off = (int)(view->ptr - base->ptr);
+        view->next = g_state->tmpviews;
+        g_state->tmpviews = view;
+    }
+    return view;
 }
 
 /*
@@ -76,7 +572,7 @@ string_t *src;
 }
 
 /*
- * Concatenate two strings
+ * Concatenate two strings into a temporary
  */
 string_t *
 concat_strings(s1, s2)
@@ -94,7 +590,15 @@ string_t *s2;
         return NULL;
     }
 
-    result = alloc_string(len1 + len2);
+    /* Nothing to join - hand back the other side */
+    if (len2 == 0) {
+        return s1 ? s1 : temp_string(0);
+    }
+    if (len1 == 0) {
+        return s2;
+    }
+
+    result = temp_string(len1 + len2);
     if (!result) {
         return NULL;
     }
@@ -110,6 +614,59 @@ string_t *s2;
     return result;
 }
 
+/*
+ * Append add to s, which the caller holds the only reference to, and
+ * return the result in place of s.  A string nobody else can see is
+ * extended in its own buffer; otherwise the copy is given spare room
+ * so that a run of appends copies only each time the room doubles.
+ */
+string_t *
+append_string(s, add)
+string_t *s;
+string_t *add;
+{
+    string_t *result;
+    int len, room;
+
+    if (!add || add->len == 0) {
+        return s;
+    }
+    if (!s || s->len == 0) {
+        free_string(s);
+        return keep_string(add);
+    }
+
+    len = s->len + add->len;
+    if (len > 255) {
+        error(ERR_STRING_LONG);
+        return s;
+    }
+
+    /* Room already there: the descriptor's own buffer or spare space */
+    room = (s->ptr == s->sbuf) ? STRSHORT : s->size - 1;
+    if (s->refs == 1 && !s->base && len <= room) {
+        memcpy(s->ptr + s->len, add->ptr, add->len);
+        s->len = len;
+        s->ptr[len] = '\0';
+        return s;
+    }
+
+    room = len * 2;
+    if (room > 255) {
+        room = 255;
+    }
+    result = alloc_room(len, room);
+    if (!result) {
+        return s;
+    }
+
+    memcpy(result->ptr, s->ptr, s->len);
+    memcpy(result->ptr + s->len, add->ptr, add->len);
+    result->ptr[len] = '\0';
+    free_string(s);
+    return result;
+}
+
 /*
  * Compare two strings
  */
@@ -20,8 +20,18 @@
 200 RESTORE
 210 READ X
 220 PRINT "FIRST VALUE AGAIN: "; X
-230 PRINT
-240 PRINT "=== DATA/READ TESTS DONE ==="
+230 RESTORE 510
+232 READ N$
+234 PRINT "AFTER RESTORE 510: "; N$
+236 PRINT
+237 REM SEVERAL DATA STATEMENTS ON ONE LINE
+238 RESTORE 520
+239 READ A, B, C, D$
+240 PRINT "AFTER RESTORE 520: "; A; B; C; " "; D$
+241 PRINT
+242 PRINT "=== DATA/READ TESTS DONE ==="
 250 END
 500 DATA 10, 20, 30, 40, 50
 510 DATA "ALPHA", "BETA", "GAMMA"
+520 DATA 1: DATA 2
+530 X = 0: DATA 3, "A:B"
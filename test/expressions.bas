@@ -25,5 +25,29 @@
 250 PRINT "1.5 * 2.0 = "; 1.5 * 2.0
 260 PRINT "10.0 / 4.0 = "; 10.0 / 4.0
 270 PRINT
-280 PRINT "=== EXPRESSION TESTS DONE ==="
-290 END
+280 REM CONSTANTS WITH VARIABLES
+290 PRINT "CONSTANTS WITH VARIABLES:"
+300 R = 2
+310 PRINT "2 * 3 * R = "; 2 * 3 * R; " (SHOULD BE 12)"
+320 PRINT "R - 2 + 3 = "; R - 2 + 3; " (SHOULD BE 3)"
+330 PRINT "R ^ 2 * 3 = "; R ^ 2 * 3; " (SHOULD BE 12)"
+340 PRINT "SQR(16) + R = "; SQR(16) + R; " (SHOULD BE 6)"
+350 PRINT
+360 REM CONSTANT FUNCTION ARGUMENTS
+370 PRINT "CONSTANT FUNCTION ARGUMENTS:"
+380 B$ = STR$(1) + STR$(2)
+390 PRINT "STR$(1) + STR$(2) = ["; B$; "] (SHOULD BE [ 1 2])"
+400 C$ = STR$(1) + "A"
+410 PRINT "STR$(1) + 'A' = ["; C$; "] (SHOULD BE [ 1A])"
+420 PRINT "(1) + 2 = "; (1) + 2; " (SHOULD BE 3)"
+430 PRINT "TAB(3) - 1 (SHOULD BE -1 AT COLUMN 3):"
+440 PRINT TAB(3) - 1
+450 PRINT
+460 REM RELATIONS DO NOT CHAIN
+470 PRINT "RELATIONS DO NOT CHAIN:"
+480 X = 0
+490 PRINT "10*(4)*(4)<3=2 = "; 10*(4)*(4)<3=2; " (SHOULD BE 0  0)"
+500 PRINT "-1>=2<-1 OR (X) = "; -1>=2<-1 OR (X); " (SHOULD BE 0  0)"
+510 PRINT
+520 PRINT "=== EXPRESSION TESTS DONE ==="
+530 END
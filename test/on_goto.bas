@@ -23,6 +23,7 @@
 230 ON X GOSUB 300, 320, 340
 240 PRINT " (RETURNED)"
 250 NEXT X
+255 ON 2 GOSUB 300, 320, 340: PRINT " (BACK ON LINE 255)"
 260 PRINT
 270 PRINT "=== ON GOTO/GOSUB TESTS DONE ==="
 280 END
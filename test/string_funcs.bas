@@ -22,5 +22,16 @@
 220 PRINT "STR$(123) = "; CHR$(34); STR$(123); CHR$(34)
 230 PRINT "VAL("; CHR$(34); "456"; CHR$(34); ") = "; VAL("456")
 240 PRINT
-250 PRINT "=== STRING FUNCTIONS DONE ==="
-260 END
+241 PRINT "CONCATENATION:"
+242 B$ = LEFT$(A$,5) + "," + MID$(A$,6)
+243 PRINT "LEFT$+MID$ = "; CHR$(34); B$; CHR$(34)
+244 C$ = ""
+245 FOR I = 1 TO 5: C$ = C$ + CHR$(64+I): NEXT I
+246 PRINT "BUILT = "; C$; " LEN"; LEN(C$)
+247 D$ = C$: C$ = C$ + "!"
+248 PRINT "COPY = "; D$; " APPENDED = "; C$
+249 E$ = STR$(1) + "A": F$ = CHR$(65) + "B"
+250 PRINT "STR$(1)+A = "; CHR$(34); E$; CHR$(34); " CHR$(65)+B = "; F$
+251 PRINT
+260 PRINT "=== STRING FUNCTIONS DONE ==="
+270 END
@@ -21,6 +21,14 @@
 210 B$ = "WORLD"
 220 PRINT "A$ = "; A$
 230 PRINT "B$ = "; B$
+232 AB$ = "TWO CHARS"
+234 PRINT "AB$ = "; AB$
 240 PRINT
+241 REM INTEGER VARIABLES
+242 I% = 7.9: J% = -7.9: K% = I% * J% + 1
+243 PRINT "I% = "; I%; " J% = "; J%; " K% = "; K%
+244 DIM N%(3): N%(1) = I% AND 3: N%(2) = I% > J%
+245 PRINT "N%(1) = "; N%(1); " N%(2) = "; N%(2)
+246 PRINT
 250 PRINT "=== VARIABLE TESTS DONE ==="
 260 END
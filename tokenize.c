@@ -126,6 +126,37 @@ const char *word;
     return 0;
 }
 
+/*
+ * Pack a double into NUMLEN bytes of 7 bits each with the high bit
+ * set, so the value never reads as a terminator, ':' or quote
+ */
+void
+pack_number(p, num)
+unsigned char *p;
+double num;
+{
+    union {
+        double d;
+        unsigned char b[sizeof(double)];
+    } u;
+    unsigned int acc;
+    int bits, i;
+
+    u.d = num;
+    acc = 0;
+    bits = 0;
+    for (i = 0; i < (int)sizeof(double); i++) {
+        acc = (acc << 8) | u.b[i];
+        bits += 8;
+        while (bits >= 7) {
+            bits -= 7;
+            *p++ = 0x80 | ((acc >> bits) & 0x7F);
+        }
+        acc &= (1 << bits) - 1;
+    }
+    *p = 0x80 | ((acc << (7 - bits)) & 0x7F);
+}
+
 /*
  * Tokenize a BASIC line
  */
@@ -138,9 +169,12 @@ int *len;
     unsigned char *newtokens;
     unsigned char *p;
     const char *s;
+    const char *start;
     char word[16];
-    int i, token;
-    int in_string, in_data, in_rem;
+    int i, n, token;
+    int slot;
+    int in_string, in_data, in_rem, in_target;
+    double num;
     int allocated;
     int offset;
 
@@ -155,6 +189,7 @@ int *len;
     in_string = 0;
     in_data = 0;
     in_rem = 0;
+    in_target = 0;
 
     while (*s) {
         /* Check buffer space */
@@ -183,6 +218,11 @@ int *len;
             continue;
         }
 
+        /* DATA ends at a colon outside quotes */
+        if (in_data && !in_string && *s == ':') {
+            in_data = 0;
+        }
+
         /* Copy verbatim in string/data/rem */
         if (in_string || in_data || in_rem) {
             *p++ = *s++;
@@ -199,6 +239,7 @@ int *len;
 
         /* Check for keywords (alphabetic start) */
         if (IS_ALPHA(*s)) {
+            start = s;
             i = 0;
             while ((IS_ALNUM(*s) || *s == '$') && i < 15) {
                 word[i++] = *s++;
@@ -206,6 +247,7 @@ int *len;
             word[i] = '\0';
 
             token = is_keyword(word);
+            in_target = 0;
             if (token) {
                 *p++ = token;
 
@@ -213,25 +255,95 @@ int *len;
                     in_data = 1;
                 } else if (token == TOK_REM) {
                     in_rem = 1;
+                } else if (token == TOK_GOTO || token == TOK_GOSUB ||
+                           token == TOK_THEN || token == TOK_RUN ||
+                           token == TOK_LIST || token == TOK_RESTORE) {
+                    in_target = 1;
                 }
             } else {
-                /* Not a keyword - copy as identifier */
-                for (i = 0; word[i]; i++) {
-                    *p++ = word[i];
+                /* Not a keyword - variable reference */
+                s = start;
+                while (IS_ALNUM(*s)) {
+                    s++;
+                }
+                if (*s == '$' || *s == '%') {
+                    s++;
+                }
+
+                n = s - start;
+                if (n > 127) {
+                    n = 127;
                 }
+                if (p - tokens + n + 4 >= allocated) {
+                    offset = p - tokens;
+                    allocated += n + 4;
+                    newtokens = (unsigned char *)realloc(tokens, allocated);
+                    if (!newtokens) {
+                        free(tokens);
+                        return NULL;
+                    }
+                    tokens = newtokens;
+                    p = tokens + offset;
+                }
+
+                slot = var_slot(start);
+                *p++ = TOK_VAR;
+                *p++ = 0x80 | (slot >> 6);
+                *p++ = 0x80 | (slot & 0x3F);
+                *p++ = 0x80 | n;
+                memcpy(p, start, n);
+                p += n;
             }
             continue;
         }
 
         /* Numbers */
         if (IS_DIGIT(*s) || (*s == '.' && IS_DIGIT(s[1]))) {
+            start = s;
             while (IS_DIGIT(*s) || *s == '.' || *s == 'E' || *s == 'e' ||
                    ((*s == '+' || *s == '-') && (s[-1] == 'E' || s[-1] == 'e'))) {
-                *p++ = *s++;
+                s++;
+            }
+            n = s - start;
+
+            /* Line numbers after GOTO, THEN, LIST etc. stay as digits */
+            if (in_target) {
+                memcpy(p, start, n);
+                p += n;
+                continue;
+            }
+
+            /* Anything else is converted once, here */
+            if (n > 127) {
+                n = 127;
+            }
+            if (p - tokens + n + NUMLEN + 2 >= allocated) {
+                offset = p - tokens;
+                allocated += n + NUMLEN + 2;
+                newtokens = (unsigned char *)realloc(tokens, allocated);
+                if (!newtokens) {
+                    free(tokens);
+                    return NULL;
+                }
+                tokens = newtokens;
+                p = tokens + offset;
             }
+
+            scan_number(start, n, &num);
+            *p++ = TOK_NUM;
+            pack_number(p, num);
+            p += NUMLEN;
+            *p++ = 0x80 | n;
+            memcpy(p, start, n);
+            p += n;
             continue;
         }
 
+        /* Only separators keep a line number list going */
+        if (*s != ',' && *s != '-') {
+            in_target = 0;
+        }
+
         /* Single character operators */
         switch (*s) {
             case '>':
@@ -269,7 +381,7 @@ unsigned char *tokens;
     char *newtext;
     char *p;
     unsigned char *t;
-    int i, token;
+    int i, n, token;
     int allocated;
     int offset;
 
@@ -298,6 +410,56 @@ unsigned char *tokens;
 
         token = *t & 0xFF;
 
+        /* Variable reference - reproduce the name as typed */
+        if (token == TOK_VAR) {
+            n = t[3] & 0x7F;
+            if (p - text + n >= allocated - 20) {
+                offset = p - text;
+                allocated += n + 20;
+                newtext = (char *)realloc(text, allocated);
+                if (!newtext) {
+                    free(text);
+                    return NULL;
+                }
+                text = newtext;
+                p = text + offset;
+            }
+            memcpy(p, t + 4, n);
+            p += n;
+            t += 4 + n;
+            continue;
+        }
+
+        /* Numeric literal - reproduce the digits as typed */
+        if (token == TOK_NUM) {
+            n = t[NUMLEN + 1] & 0x7F;
+            if (p - text + n >= allocated - 20) {
+                offset = p - text;
+                allocated += n + 20;
+                newtext = (char *)realloc(text, allocated);
+                if (!newtext) {
+                    free(text);
+                    return NULL;
+                }
+                text = newtext;
+                p = text + offset;
+            }
+            memcpy(p, t + NUMLEN + 2, n);
+            p += n;
+            t += NUMLEN + 2 + n;
+            continue;
+        }
+
+        /* Folded constant - list the original expression after it */
+        if (token == TOK_FOLD) {
+            t += NUMLEN + 3;
+            continue;
+        }
+        if (token == TOK_FOLDSTR) {
+            t += 2 + (t[1] & 0x7F) + 2;
+            continue;
+        }
+
         /* Check for token (high bit set) */
         if (token >= 128) {
             t++;
@@ -320,3 +482,29 @@ unsigned char *tokens;
     *p = '\0';
     return text;
 }
+
+/*
+ * Skip one item of tokenized text - a keyword token, a character, or
+ * a variable reference, numeric literal or folded constant with its
+ * operand bytes
+ */
+unsigned char *
+skip_token(p)
+unsigned char *p;
+{
+    if (*p == TOK_VAR) {
+        return p + 4 + (p[3] & 0x7F);
+    }
+    if (*p == TOK_NUM) {
+        return p + NUMLEN + 2 + (p[NUMLEN + 1] & 0x7F);
+    }
+    if (*p == TOK_FOLD) {
+        p += NUMLEN + 1;
+        return p + 2 + (((p[0] & 0x7F) << 7) | (p[1] & 0x7F));
+    }
+    if (*p == TOK_FOLDSTR) {
+        p += 2 + (p[1] & 0x7F);
+        return p + 2 + (((p[0] & 0x7F) << 7) | (p[1] & 0x7F));
+    }
+    return p + 1;
+}
@@ -8,87 +8,142 @@
 #include "m6502basic.h"
 
 /*
- * Normalize variable name (2 chars, uppercase)
+ * Map a variable name to its slot in the variable table
+ * The first character must be a letter; the second (optional) may be
+ * a letter or digit and any further ones are ignored; a $ or % suffix
+ * selects the type.  Returns -1 for a name that cannot be a variable.
  */
-static void
-normalize_name(dest, src, type)
-char *dest;
-const char *src;
-int *type;
+int
+var_slot(name)
+const char *name;
 {
-    int i;
-
-    *type = TYPE_NUM;
-    i = 0;
-
-    /* Copy up to 2 characters, convert to uppercase */
-    while (*src && i < NAMLEN) {
-        if (IS_ALNUM(*src)) {
-            if (*src >= 'a' && *src <= 'z') {
-                dest[i++] = *src - 'a' + 'A';
-            } else {
-                dest[i++] = *src;
-            }
-        } else if (*src == '$') {
-            *type = TYPE_STR;
-            break;
-        } else if (*src == '%') {
-            *type = TYPE_INT;
-            break;
-        } else {
-            break;
-        }
-        src++;
+    int c1, c2, c;
+    int type;
+
+    c = TO_UPPER(*name);
+    if (c < 'A' || c > 'Z') {
+        return -1;
     }
-    dest[i] = '\0';
+    c1 = c - 'A';
+    name++;
+
+    /* Second character: 0 = none, 1-26 = A-Z, 27-36 = 0-9 */
+    c2 = 0;
+    if (IS_ALNUM(*name)) {
+        c = TO_UPPER(*name);
+        c2 = IS_DIGIT(c) ? 27 + (c - '0') : 1 + (c - 'A');
+        name++;
+    }
+
+    /* Only two characters are significant */
+    while (IS_ALNUM(*name)) {
+        name++;
+    }
+
+    type = TYPE_NUM;
+    if (*name == '$') {
+        type = TYPE_STR;
+    } else if (*name == '%') {
+        type = TYPE_INT;
+    }
+
+    return (c1 * 37 + c2) * 3 + type;
 }
 
 /*
- * Find a variable by name, optionally create
+ * Build the name for a slot, with type suffix
+ */
+void
+slot_name(slot, name)
+int slot;
+char *name;
+{
+    int c2;
+
+    *name++ = 'A' + slot / 3 / 37;
+    c2 = slot / 3 % 37;
+    if (c2 > 26) {
+        *name++ = '0' + (c2 - 27);
+    } else if (c2 > 0) {
+        *name++ = 'A' + (c2 - 1);
+    }
+
+    if (SLOT_TYPE(slot) == TYPE_STR) {
+        *name++ = '$';
+    } else if (SLOT_TYPE(slot) == TYPE_INT) {
+        *name++ = '%';
+    }
+    *name = '\0';
+}
+
+/*
+ * Find a variable by slot, optionally create
  */
 var_t *
-find_variable(name, create)
-const char *name;
+slot_variable(slot, create)
+int slot;
 int create;
 {
     var_t *var;
-    char normname[NAMLEN+1];
-    int type;
+    int c2;
 
-    normalize_name(normname, name, &type);
+    var = g_state->varslot[slot];
+    if (var || !create) {
+        return var;
+    }
 
-    /* Search existing variables */
-    for (var = g_state->varlist; var != NULL; var = var->next) {
-        if (strcmp(var->name, normname) == 0 && var->type == type) {
-            return var;
-        }
+    var = (var_t *)malloc(sizeof(var_t));
+    if (!var) {
+        error(ERR_OUT_OF_MEM);
+        return NULL;
     }
 
-    /* Not found - create if requested */
-    if (create) {
-        var = (var_t *)malloc(sizeof(var_t));
-        if (!var) {
-            error(ERR_OUT_OF_MEM);
-            return NULL;
-        }
+    /* Rebuild the name from the slot */
+    var->type = SLOT_TYPE(slot);
+    var->name[0] = 'A' + slot / 3 / 37;
+    c2 = slot / 3 % 37;
+    if (c2 == 0) {
+        var->name[1] = '\0';
+    } else {
+        var->name[1] = c2 > 26 ? '0' + (c2 - 27) : 'A' + (c2 - 1);
+        var->name[2] = '\0';
+    }
 
-        strcpy(var->name, normname);
-        var->type = type;
+    if (var->type == TYPE_STR) {
+        var->value.strval = alloc_string(0);
+    } else if (var->type == TYPE_INT) {
+        var->value.intval = 0;
+    } else {
+        var->value.numval = 0.0;
+    }
 
-        if (type == TYPE_STR) {
-            var->value.strval = alloc_string(0);
-        } else {
-            var->value.numval = 0.0;
-        }
+    /* Add to list of live variables, for CLEAR */
+    var->next = g_state->varlist;
+    g_state->varlist = var;
+    g_state->varslot[slot] = var;
 
-        /* Add to list */
-        var->next = g_state->varlist;
-        g_state->varlist = var;
+    return var;
+}
 
-        return var;
+/*
+ * Find a variable by name, optionally create
+ */
+var_t *
+find_variable(name, create)
+const char *name;
+int create;
+{
+    int slot;
+
+    slot = var_slot(name);
+    if (slot < 0) {
+        if (create) {
+            syntax_error();
+        }
+        return NULL;
     }
 
-    return NULL;
+    return slot_variable(slot, create);
 }
 
 /*
@@ -103,7 +158,7 @@ double val;
 
     var = find_variable(name, 1);
     if (var && var->type != TYPE_STR) {
-        var->value.numval = val;
+        set_var_num(var, val);
     }
 }
 
@@ -119,10 +174,11 @@ string_t *val;
 
     var = find_variable(name, 1);
     if (var && var->type == TYPE_STR) {
+        val = keep_string(val);
         if (var->value.strval) {
             free_string(var->value.strval);
         }
-        var->value.strval = copy_string(val);
+        var->value.strval = val;
     }
 }
 
@@ -137,7 +193,7 @@ const char *name;
 
     var = find_variable(name, 0);
     if (var && var->type != TYPE_STR) {
-        return var->value.numval;
+        return var_num(var);
     }
 
     return 0.0;
@@ -160,6 +216,49 @@ const char *name;
     return NULL;
 }
 
+/*
+ * Integer a number is stored as in a % variable - rounded down like
+ * INT, ?FC outside -32768 to 32767
+ */
+int
+int_value(x)
+double x;
+{
+    if (x < -32768.0 || x >= 32768.0) {
+        error(ERR_ILLEGAL_FUNC);
+        return 0;
+    }
+    return (int)floor(x);
+}
+
+/*
+ * Value of a numeric or integer variable
+ */
+double
+var_num(var)
+var_t *var;
+{
+    if (var->type == TYPE_INT) {
+        return (double)var->value.intval;
+    }
+    return var->value.numval;
+}
+
+/*
+ * Assign to a numeric or integer variable
+ */
+void
+set_var_num(var, x)
+var_t *var;
+double x;
+{
+    if (var->type == TYPE_INT) {
+        var->value.intval = (short)int_value(x);
+    } else {
+        var->value.numval = x;
+    }
+}
+
 /*
  * Clear all variables
  */
@@ -182,4 +281,11 @@ clear_variables()
     }
 
     g_state->varlist = NULL;
+    memset(g_state->varslot, 0, sizeof(g_state->varslot));
+
+    /* FOR loops point at the old variables' storage */
+    g_state->forsp = 0;
+
+    /* Compiled code holds pointers to the old variables */
+    vm_flush();
 }
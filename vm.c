@@ -0,0 +1,1745 @@
+/*
+ * vm.c - Statement compiler and bytecode virtual machine
+ *
+ * Microsoft BASIC 6502 C Port
+ * K&R C v2 compatible
+ *
+ * The first time a program statement is executed it is lowered to a
+ * short sequence of stack machine instructions with its operands
+ * already resolved: numeric literals are converted, variables are
+ * bound to their var_t and constant GOTO targets to their line_t.
+ * Later executions run the bytecode instead of re-reading the text.
+ *
+ * The compiler follows the same grammar as eval.c and statements.c.
+ * Anything it does not handle marks the statement as not compiled and
+ * execute_statement() interprets it as before.  Compiled code is keyed
+ * by the statement's offset from txttab and is thrown away whenever the
+ * program text or the variable list changes.  When it outgrows VM_CACHE
+ * bytes a clock sweep over the table frees the code of statements that
+ * have not run since the sweep last passed them.
+ *
+ * The compiler knows the kind of every value it pushes.  Integer
+ * variables and small whole literals are integers, as are relations and
+ * logical operators applied to integers, and arithmetic between two
+ * 16-bit integers is done in a long without going through floating
+ * point; values are converted only where an operator needs the other
+ * kind.
+ *
+ * The instruction set is in m6502basic.h, where jit.c can also read it
+ * to translate statements that run often.
+ */
+
+#include "m6502basic.h"
+
+/*
+ * Dispatch.  Where the compiler has labels as values, each instruction
+ * jumps straight to the next one's handler through vm_labels[] instead
+ * of going back around the switch; the switch is still there for other
+ * compilers, or when built with -DVM_SWITCH.
+ */
+#if defined(__GNUC__) && !defined(VM_SWITCH)
+#define VM_THREADED 1
+#define VM_CASE(op) case op: L_##op
+#define VM_DISPATCH goto *vm_labels[ip->op]
+#define VM_NEXT     goto *vm_labels[(++ip)->op]
+#else
+#define VM_THREADED 0
+#define VM_CASE(op) case op
+#define VM_DISPATCH
+#define VM_NEXT     break
+#endif
+
+/* Kinds of value on the evaluation stack, known at compile time */
+#define VT_NUM      0   /* Floating point */
+#define VT_INT      1   /* Integer in -32768..32767 */
+#define VT_LONG     2   /* Integer result of integer arithmetic */
+
+#define VM_STACK    32  /* Evaluation stack depth */
+#define VM_CODE     128 /* Instructions per statement */
+#define VM_HASH     509 /* Code table buckets */
+#if IS_16BIT
+#define VM_CACHE    8192L   /* Bytes of compiled code kept */
+#else
+#define VM_CACHE    262144L
+#endif
+
+/* Compiled statement */
+typedef struct vmcode_s vmcode_t;
+struct vmcode_s {
+    unsigned int offset;    /* Statement offset from txttab */
+    unsigned int end;       /* Offset where the statement ends */
+    vminsn_t *insn;         /* Code, NULL if not compiled */
+    int size;               /* Bytes this entry holds */
+    int used;               /* Run since the clock last passed */
+    vmcode_t *next;         /* Next in hash chain */
+#if HAVE_JIT
+    unsigned int runs;      /* Times run by vm_run() */
+    jitfn_t native;         /* Native code, once hot */
+#endif
+};
+
+static vmcode_t *vm_table[VM_HASH];
+static long vm_bytes;                   /* Memory held by vm_table */
+static int vm_hand;                     /* Bucket the clock sweeps next */
+
+/* Compiler state */
+static vminsn_t cbuf[VM_CODE];
+static vminsn_t cspare;
+static int ccount;
+static int cdepth;
+static int cfail;
+
+/* Forward declarations */
+static int c_or();
+
+/*
+ * Emit an instruction, tracking evaluation stack depth
+ */
+static vminsn_t *
+emit(op, arg, effect)
+int op;
+int arg;
+int effect;
+{
+    vminsn_t *ip;
+
+    cdepth += effect;
+    if (cdepth >= VM_STACK) {
+        cfail = 1;
+    }
+
+    if (ccount >= VM_CODE) {
+        cfail = 1;
+        ip = &cspare;
+    } else {
+        ip = &cbuf[ccount++];
+    }
+    ip->op = op;
+    ip->arg = arg;
+    return ip;
+}
+
+/*
+ * Read a variable reference - returns its slot, or -1 if there is none
+ */
+static int
+c_varref()
+{
+    skip_spaces();
+    if ((peek_char() & 0xFF) != TOK_VAR) {
+        cfail = 1;
+        return -1;
+    }
+    return get_varref();
+}
+
+/*
+ * Is the text pointer at the end of a statement?
+ */
+static int
+at_stmt_end()
+{
+    skip_spaces();
+    return peek_char() == '\0' || peek_char() == ':';
+}
+
+/*
+ * Make the value compiled from start to end a number
+ * A lone integer literal is rewritten in place; anything else gets a
+ * conversion, of the top of stack or of the one below it.
+ */
+static void
+c_float(type, start, end, below)
+int type;
+int start;
+int end;
+int below;
+{
+    if (type == VT_NUM) {
+        return;
+    }
+    if (end == start + 1 && end <= VM_CODE && cbuf[start].op == OP_INUM) {
+        cbuf[start].op = OP_NUM;
+        cbuf[start].u.num = (double)cbuf[start].arg;
+        return;
+    }
+    emit(below ? OP_FLT2 : OP_FLT, 0, 0);
+}
+
+/*
+ * Make the value on top of the stack a 16-bit integer
+ */
+static void
+c_int(type)
+int type;
+{
+    if (type == VT_NUM) {
+        emit(OP_CINT, 0, 0);
+    }
+}
+
+/*
+ * Compile optional-parenthesis function argument
+ */
+static void
+c_fnarg()
+{
+    int start;
+    int type;
+
+    skip_spaces();
+    if (peek_char() == '(') get_next_char();
+    start = ccount;
+    type = c_or();
+    c_float(type, start, ccount, 0);
+    skip_spaces();
+    if (peek_char() == ')') get_next_char();
+}
+
+/*
+ * Compile subscript list after '(' - returns the OP_ARR argument,
+ * the number of subscripts and which of them are integers
+ */
+static int
+c_subscripts()
+{
+    int n, arg;
+
+    n = 0;
+    arg = 0;
+    while (n < 11) {
+        if (c_or() != VT_NUM) {
+            arg |= 1 << (4 + n);
+        }
+        n++;
+        skip_spaces();
+        if (peek_char() == ',') {
+            get_next_char();
+        } else {
+            break;
+        }
+    }
+
+    skip_spaces();
+    if (peek_char() == ')') {
+        get_next_char();
+    }
+    return arg | n;
+}
+
+/*
+ * Push a numeric literal, as an integer if it is a small whole number
+ */
+static int
+c_literal(num)
+double num;
+{
+    vminsn_t *ip;
+
+    if (num >= -32768.0 && num <= 32767.0 && num == floor(num)) {
+        emit(OP_INUM, (int)num, 1);
+        return VT_INT;
+    }
+    ip = emit(OP_NUM, 0, 1);
+    ip->u.num = num;
+    return VT_NUM;
+}
+
+/*
+ * Primary expression
+ */
+static int
+c_primary()
+{
+    int c, token;
+    int slot;
+    int arg;
+    int type;
+    vminsn_t *ip;
+
+    skip_spaces();
+    c = peek_char();
+
+    /* Number */
+    if ((c & 0xFF) == TOK_NUM || (c & 0xFF) == TOK_FOLD) {
+        return c_literal(get_numlit());
+    }
+    if (IS_DIGIT(c) || (c == '.' && IS_DIGIT(g_state->txtptr[1]))) {
+        return c_literal(parse_number());
+    }
+
+    /* Parenthesized expression */
+    if (c == '(') {
+        get_next_char();
+        type = c_or();
+        skip_spaces();
+        if (peek_char() == ')') {
+            get_next_char();
+        }
+        return type;
+    }
+
+    /* Variable or array */
+    token = c & 0xFF;
+    if (token == TOK_VAR) {
+        slot = get_varref();
+        if (SLOT_TYPE(slot) == TYPE_STR) {
+            cfail = 1;
+            return VT_NUM;
+        }
+
+        skip_spaces();
+        if (peek_char() == '(') {
+            get_next_char();
+            arg = c_subscripts();
+            if (SLOT_TYPE(slot) == TYPE_INT) {
+                ip = emit(OP_IARR, arg, 1 - SUB_COUNT(arg));
+                ip->u.slot = slot;
+                return VT_INT;
+            }
+            ip = emit(OP_ARR, arg, 1 - SUB_COUNT(arg));
+            ip->u.slot = slot;
+            return VT_NUM;
+        }
+
+        if (SLOT_TYPE(slot) == TYPE_INT) {
+            ip = emit(OP_IVAR, 0, 1);
+            ip->u.var = slot_variable(slot, 1);
+            return VT_INT;
+        }
+        ip = emit(OP_VAR, 0, 1);
+        ip->u.var = slot_variable(slot, 1);
+        return VT_NUM;
+    }
+
+    /* Numeric functions - string functions are left to eval.c */
+    if (token >= 128) {
+        switch (token) {
+            case TOK_SGN: case TOK_INT: case TOK_ABS: case TOK_SQR:
+            case TOK_RND: case TOK_SIN: case TOK_COS: case TOK_TAN:
+            case TOK_ATN: case TOK_LOG: case TOK_EXP: case TOK_PEEK:
+            case TOK_FRE: case TOK_POS:
+                get_next_char();
+                c_fnarg();
+                emit(OP_FN, token, 0);
+                return VT_NUM;
+        }
+        cfail = 1;
+        return VT_NUM;
+    }
+
+    /* String literal */
+    if (c == '"') {
+        cfail = 1;
+        return VT_NUM;
+    }
+
+    /* Anything else evaluates to zero without consuming input */
+    ip = emit(OP_NUM, 0, 1);
+    ip->u.num = 0.0;
+    return VT_NUM;
+}
+
+/*
+ * Unary operators
+ */
+static int
+c_unary()
+{
+    int c;
+    int start;
+    int type;
+
+    skip_spaces();
+    c = peek_char();
+
+    if (c == '-' || (c & 0xFF) == TOK_MINUS) {
+        get_next_char();
+        start = ccount;
+        type = c_unary();
+        if (type == VT_INT) {
+            /* Negative literals are just literals */
+            if (ccount == start + 1 && ccount <= VM_CODE &&
+                cbuf[start].op == OP_INUM && cbuf[start].arg > -32768) {
+                cbuf[start].arg = -cbuf[start].arg;
+                return VT_INT;
+            }
+            emit(OP_INEG, 0, 0);
+            return VT_LONG;
+        }
+        c_float(type, start, ccount, 0);
+        emit(OP_NEG, 0, 0);
+        return VT_NUM;
+    }
+
+    if ((c & 0xFF) == TOK_NOT) {
+        get_next_char();
+        if (c_unary() == VT_NUM) {
+            emit(OP_NOT, 0, 0);
+            return VT_NUM;
+        }
+        emit(OP_INOT, 0, 0);
+        return VT_INT;
+    }
+
+    if (c == '+' || (c & 0xFF) == TOK_PLUS) {
+        get_next_char();
+        return c_unary();
+    }
+
+    return c_primary();
+}
+
+/*
+ * Power operator
+ */
+static int
+c_power()
+{
+    int lstart, rstart;
+    int type, rtype;
+
+    lstart = ccount;
+    type = c_unary();
+
+    skip_spaces();
+    while (peek_char() == '^' || (peek_char() & 0xFF) == TOK_POWER) {
+        get_next_char();
+        rstart = ccount;
+        rtype = c_unary();
+        c_float(rtype, rstart, ccount, 0);
+        c_float(type, lstart, rstart, 1);
+        emit(OP_POW, 0, -1);
+        type = VT_NUM;
+        skip_spaces();
+    }
+
+    return type;
+}
+
+/*
+ * Multiplication and division
+ */
+static int
+c_mult()
+{
+    int op;
+    int lstart, rstart;
+    int ltype, rtype;
+
+    lstart = ccount;
+    ltype = c_power();
+
+    while (!cfail) {
+        skip_spaces();
+        op = peek_char();
+
+        if (op == '*' || (op & 0xFF) == TOK_MULT) {
+            get_next_char();
+            rstart = ccount;
+            rtype = c_power();
+            if (ltype == VT_INT && rtype == VT_INT) {
+                emit(OP_IMUL, 0, -1);
+                ltype = VT_LONG;
+                continue;
+            }
+            c_float(rtype, rstart, ccount, 0);
+            c_float(ltype, lstart, rstart, 1);
+            emit(OP_MUL, 0, -1);
+        } else if (op == '/' || (op & 0xFF) == TOK_DIV) {
+            get_next_char();
+            rstart = ccount;
+            rtype = c_power();
+            c_float(rtype, rstart, ccount, 0);
+            c_float(ltype, lstart, rstart, 1);
+            emit(OP_DIV, 0, -1);
+        } else {
+            break;
+        }
+        ltype = VT_NUM;
+    }
+
+    return ltype;
+}
+
+/*
+ * Addition and subtraction
+ */
+static int
+c_add()
+{
+    int op;
+    int lstart, rstart;
+    int ltype, rtype;
+
+    lstart = ccount;
+    ltype = c_mult();
+
+    while (!cfail) {
+        skip_spaces();
+        op = peek_char();
+
+        if (op == '+' || (op & 0xFF) == TOK_PLUS) {
+            op = OP_ADD;
+        } else if (op == '-' || (op & 0xFF) == TOK_MINUS) {
+            op = OP_SUB;
+        } else {
+            break;
+        }
+        get_next_char();
+        rstart = ccount;
+        rtype = c_mult();
+
+        if (ltype == VT_INT && rtype == VT_INT) {
+            emit(op == OP_ADD ? OP_IADD : OP_ISUB, 0, -1);
+            ltype = VT_LONG;
+        } else {
+            c_float(rtype, rstart, ccount, 0);
+            c_float(ltype, lstart, rstart, 1);
+            emit(op, 0, -1);
+            ltype = VT_NUM;
+        }
+    }
+
+    return ltype;
+}
+
+/*
+ * Comparison operators - same relation codes as expr_compare()
+ */
+static int
+c_compare()
+{
+    int op1, op2;
+    int relation;
+    int lstart, rstart;
+    int ltype, rtype;
+
+    lstart = ccount;
+    ltype = c_add();
+
+    skip_spaces();
+    op1 = peek_char();
+
+    if (op1 == '<' || op1 == '>' || op1 == '=' ||
+        (op1 & 0xFF) == TOK_LT || (op1 & 0xFF) == TOK_GT || (op1 & 0xFF) == TOK_EQ) {
+
+        get_next_char();
+        skip_spaces();
+        op2 = peek_char();
+
+        relation = 0;
+        if (op1 == '<' || (op1 & 0xFF) == TOK_LT) {
+            relation = 1;
+            if (op2 == '>' || (op2 & 0xFF) == TOK_GT) {
+                get_next_char();
+                relation = 5;
+            } else if (op2 == '=' || (op2 & 0xFF) == TOK_EQ) {
+                get_next_char();
+                relation = 3;
+            }
+        } else if (op1 == '>' || (op1 & 0xFF) == TOK_GT) {
+            relation = 2;
+            if (op2 == '=' || (op2 & 0xFF) == TOK_EQ) {
+                get_next_char();
+                relation = 4;
+            } else if (op2 == '<' || (op2 & 0xFF) == TOK_LT) {
+                get_next_char();
+                relation = 5;
+            }
+        } else {
+            relation = 6;
+            if (op2 == '<' || (op2 & 0xFF) == TOK_LT) {
+                get_next_char();
+                relation = 3;
+            } else if (op2 == '>' || (op2 & 0xFF) == TOK_GT) {
+                get_next_char();
+                relation = 4;
+            }
+        }
+
+        rstart = ccount;
+        rtype = c_add();
+        if (ltype != VT_NUM && rtype != VT_NUM) {
+            emit(OP_IREL, relation, -1);
+            return VT_INT;
+        }
+        c_float(rtype, rstart, ccount, 0);
+        c_float(ltype, lstart, rstart, 1);
+        emit(OP_REL, relation, -1);
+        return VT_NUM;
+    }
+
+    return ltype;
+}
+
+/*
+ * Combine two operands of AND or OR
+ */
+static int
+c_logical(op, iop, lstart, ltype, rstart, rtype)
+int op;
+int iop;
+int lstart;
+int ltype;
+int rstart;
+int rtype;
+{
+    if (ltype != VT_NUM && rtype != VT_NUM) {
+        emit(iop, 0, -1);
+        return (ltype == VT_INT && rtype == VT_INT) ? VT_INT : VT_LONG;
+    }
+    c_float(rtype, rstart, ccount, 0);
+    c_float(ltype, lstart, rstart, 1);
+    emit(op, 0, -1);
+    return VT_NUM;
+}
+
+/*
+ * AND operator
+ */
+static int
+c_and()
+{
+    int lstart, rstart;
+    int type;
+
+    lstart = ccount;
+    type = c_compare();
+
+    while (!cfail) {
+        skip_spaces();
+        if ((peek_char() & 0xFF) == TOK_AND) {
+            get_next_char();
+            rstart = ccount;
+            type = c_logical(OP_AND, OP_IAND, lstart, type,
+                             rstart, c_compare());
+        } else {
+            break;
+        }
+    }
+
+    return type;
+}
+
+/*
+ * OR operator (top level)
+ */
+static int
+c_or()
+{
+    int lstart, rstart;
+    int type;
+
+    if (cfail) {
+        return VT_NUM;
+    }
+
+    lstart = ccount;
+    type = c_and();
+
+    while (!cfail) {
+        skip_spaces();
+        if ((peek_char() & 0xFF) == TOK_OR) {
+            get_next_char();
+            rstart = ccount;
+            type = c_logical(OP_OR, OP_IOR, lstart, type,
+                             rstart, c_and());
+        } else {
+            break;
+        }
+    }
+
+    return type;
+}
+
+/*
+ * Compile a numeric expression
+ */
+static void
+c_num()
+{
+    int start;
+    int type;
+
+    start = ccount;
+    type = c_or();
+    c_float(type, start, ccount, 0);
+}
+
+/*
+ * Expect '=' as do_let() and do_for() do
+ */
+static int
+c_equals()
+{
+    skip_spaces();
+    if (peek_char() == '=') {
+        get_next_char();
+        return 1;
+    }
+    if (match_token(TOK_EQ)) {
+        if (peek_char() == '=') get_next_char();
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Compile a line number target for GOTO/GOSUB
+ * A constant target is resolved now, anything else at run time.
+ */
+static void
+c_target(op, opx)
+int op;
+int opx;
+{
+    int start;
+    int linenum;
+    vminsn_t *ip;
+
+    start = ccount;
+    c_num();
+
+    if (!cfail && ccount == start + 1 && cbuf[start].op == OP_NUM) {
+        linenum = (int)cbuf[start].u.num;
+        ccount = start;
+        cdepth--;
+        ip = emit(op, linenum, 0);
+        ip->u.line = find_line(linenum);
+    } else {
+        emit(opx, 0, -1);
+    }
+}
+
+/*
+ * LET (explicit or implied)
+ */
+static void
+c_let()
+{
+    int slot, arg;
+    vminsn_t *ip;
+
+    slot = c_varref();
+    if (slot < 0 || SLOT_TYPE(slot) == TYPE_STR) {
+        cfail = 1;
+        return;
+    }
+
+    skip_spaces();
+    if (peek_char() == '(') {
+        get_next_char();
+        arg = c_subscripts();
+        if (!c_equals()) {
+            cfail = 1;
+            return;
+        }
+        if (SLOT_TYPE(slot) == TYPE_INT) {
+            ip = emit(OP_IELEM, arg, -SUB_COUNT(arg));
+            ip->u.slot = slot;
+            c_int(c_or());
+            emit(OP_ISTORE, 0, -1);
+            return;
+        }
+        ip = emit(OP_ELEM, arg, -SUB_COUNT(arg));
+        ip->u.slot = slot;
+        c_num();
+        emit(OP_STORE, 0, -1);
+        return;
+    }
+
+    if (!c_equals()) {
+        cfail = 1;
+        return;
+    }
+    if (SLOT_TYPE(slot) == TYPE_INT) {
+        c_int(c_or());
+        ip = emit(OP_ILET, 0, -1);
+    } else {
+        c_num();
+        ip = emit(OP_LET, 0, -1);
+    }
+    ip->u.var = slot_variable(slot, 1);
+}
+
+/*
+ * FOR
+ */
+static void
+c_for()
+{
+    int slot;
+    vminsn_t *ip;
+    var_t *var;
+
+    emit(OP_FORCHK, 0, 0);
+
+    slot = c_varref();
+    if (slot < 0 || SLOT_TYPE(slot) != TYPE_NUM || !c_equals()) {
+        cfail = 1;
+        return;
+    }
+    var = slot_variable(slot, 1);
+
+    c_num();
+    ip = emit(OP_LET, 0, -1);
+    ip->u.var = var;
+
+    skip_spaces();
+    if (!match_token(TOK_TO)) {
+        cfail = 1;
+        return;
+    }
+    c_num();
+
+    skip_spaces();
+    if (match_token(TOK_STEP)) {
+        c_num();
+    } else {
+        ip = emit(OP_NUM, 0, 1);
+        ip->u.num = 1.0;
+    }
+
+    ip = emit(OP_FOR, 0, -2);
+    ip->u.var = var;
+}
+
+/*
+ * NEXT
+ */
+static void
+c_next()
+{
+    int slot;
+    vminsn_t *ip;
+
+    ip = emit(OP_NEXT, 0, 0);
+    ip->u.var = NULL;
+
+    skip_spaces();
+    if ((peek_char() & 0xFF) == TOK_VAR) {
+        slot = get_varref();
+        if (SLOT_TYPE(slot) != TYPE_NUM) {
+            cfail = 1;
+            return;
+        }
+        ip->u.var = slot_variable(slot, 1);
+    }
+}
+
+/*
+ * IF
+ */
+static void
+c_if(eol)
+unsigned int eol;
+{
+    emit(c_or() == VT_NUM ? OP_IF : OP_IIF, (int)eol, -1);
+
+    skip_spaces();
+    if ((peek_char() & 0xFF) == TOK_THEN) {
+        get_next_char();
+    }
+
+    skip_spaces();
+    if (IS_DIGIT(peek_char())) {
+        c_target(OP_GOTO, OP_GOTOX);
+    } else {
+        emit(OP_THEN, (int)(g_state->txtptr - g_state->txttab), 0);
+    }
+}
+
+/*
+ * Read a constant line number - returns it, or -1 if the target is
+ * anything else
+ */
+static int
+c_linenum()
+{
+    int start;
+    int linenum;
+
+    start = ccount;
+    c_num();
+    if (cfail || ccount != start + 1 || cbuf[start].op != OP_NUM) {
+        cfail = 1;
+        return -1;
+    }
+    linenum = (int)cbuf[start].u.num;
+    ccount = start;
+    cdepth--;
+    return linenum;
+}
+
+/*
+ * ON expr GOTO/GOSUB line, line, ...
+ * The targets follow the OP_ON as a table of resolved lines.
+ */
+static void
+c_on()
+{
+    int op, n, linenum;
+    vminsn_t *ip;
+    vminsn_t *on;
+
+    c_num();
+
+    skip_spaces();
+    if (match_token(TOK_GOTO)) {
+        op = OP_ON;
+    } else if (match_token(TOK_GOSUB)) {
+        op = OP_ONGOSUB;
+    } else {
+        cfail = 1;
+        return;
+    }
+    on = emit(op, 0, -1);
+
+    n = 0;
+    while (!cfail) {
+        linenum = c_linenum();
+        ip = emit(OP_GOTO, linenum, 0);
+        ip->u.line = find_line(linenum);
+        n++;
+
+        skip_spaces();
+        if (peek_char() == ',') {
+            get_next_char();
+        } else {
+            break;
+        }
+    }
+    on->arg = n;
+}
+
+/*
+ * PRINT - numbers and string literals; any other string item leaves
+ * the statement to do_print()
+ */
+static void
+c_print()
+{
+    int c, n, newline;
+    unsigned char *p;
+    vminsn_t *ip;
+
+    newline = 1;
+
+    while (!cfail) {
+        skip_spaces();
+        c = peek_char();
+
+        if (c == '\0' || c == ':') {
+            break;
+        }
+
+        if (c == ';') {
+            get_next_char();
+            newline = 0;
+            continue;
+        }
+
+        if (c == ',') {
+            get_next_char();
+            emit(OP_PRCOMMA, 0, 0);
+            newline = 0;
+            continue;
+        }
+
+        if ((c & 0xFF) == TOK_TAB || (c & 0xFF) == TOK_SPC) {
+            get_next_char();
+            skip_spaces();
+            if (peek_char() == '(') get_next_char();
+            c_num();
+            skip_spaces();
+            if (peek_char() == ')') get_next_char();
+            emit(OP_PRTAB, (c & 0xFF) == TOK_SPC, -1);
+            newline = 0;
+            continue;
+        }
+
+        /* String literal, as parse_string_literal() reads it */
+        if (c == '"' || (c & 0xFF) == TOK_FOLDSTR) {
+            p = g_state->txtptr;
+            if (c == '"') {
+                p++;
+                for (n = 0; p[n] && p[n] != '"'; n++)
+                    ;
+                g_state->txtptr = p + n + (p[n] == '"');
+                if (n > 255) {
+                    n = 255;
+                }
+            } else {
+                n = p[1] & 0x7F;
+                g_state->txtptr = skip_token(p);
+                p += 2;
+            }
+
+            /* Concatenation is for eval_string() */
+            skip_spaces();
+            c = peek_char();
+            if (c == '+' || (c & 0xFF) == TOK_PLUS) {
+                cfail = 1;
+                return;
+            }
+
+            ip = emit(OP_PRSTR, n, 0);
+            ip->u.text = p;
+            newline = 1;
+            continue;
+        }
+
+        c_num();
+        emit(OP_PRNUM, 0, -1);
+        newline = 1;
+    }
+
+    if (newline) {
+        emit(OP_PRNL, 0, 0);
+    }
+}
+
+/*
+ * Compile the statement at txtptr into cbuf
+ * Returns end-of-statement offset.
+ */
+static unsigned int
+compile_statement(eol)
+unsigned int eol;
+{
+    int c;
+
+    c = peek_char();
+
+    if ((c & 0xFF) == TOK_VAR) {
+        c_let();
+    } else {
+        get_next_char();
+        switch (c) {
+            case TOK_LET:
+                c_let();
+                break;
+
+            case TOK_GOTO:
+                c_target(OP_GOTO, OP_GOTOX);
+                break;
+
+            case TOK_GOSUB:
+                emit(OP_GOSCHK, 0, 0);
+                c_target(OP_GOSUB, OP_GOSUBX);
+                break;
+
+            case TOK_RETURN:
+                emit(OP_RETURN, 0, 0);
+                break;
+
+            case TOK_PRINT:
+                c_print();
+                break;
+
+            case TOK_ON:
+                c_on();
+                break;
+
+            case TOK_FOR:
+                c_for();
+                break;
+
+            case TOK_NEXT:
+                c_next();
+                break;
+
+            case TOK_IF:
+                c_if(eol);
+                return eol;
+
+            case TOK_REM:
+                return eol;
+
+            case TOK_DATA:
+                do_data();
+                break;
+
+            case TOK_END:
+                emit(OP_END, 0, 0);
+                break;
+
+            default:
+                cfail = 1;
+                break;
+        }
+    }
+
+    if (!cfail && !at_stmt_end()) {
+        cfail = 1;
+    }
+    return (unsigned int)(g_state->txtptr - g_state->txttab);
+}
+
+/*
+ * Free one entry of the code table
+ */
+static void
+vm_free(code)
+vmcode_t *code;
+{
+    vm_bytes -= code->size;
+    if (code->insn) {
+        free(code->insn);
+    }
+    free(code);
+}
+
+/*
+ * Sweep the table a bucket at a time until a quarter of VM_CACHE is
+ * free.  Code run again since the last pass only loses its mark, so
+ * the statements of a running loop stay compiled; code run once, or
+ * not since, is freed.
+ */
+static void
+vm_evict()
+{
+    vmcode_t **link;
+    vmcode_t *code;
+    int n;
+
+    for (n = 0; n < 2 * VM_HASH && vm_bytes > VM_CACHE - VM_CACHE / 4;
+         n++) {
+        link = &vm_table[vm_hand];
+        while ((code = *link) != NULL) {
+            if (code->used) {
+                code->used = 0;
+                link = &code->next;
+            } else {
+                *link = code->next;
+                vm_free(code);
+            }
+        }
+        vm_hand = (vm_hand + 1) % VM_HASH;
+    }
+}
+
+/*
+ * Look up or build the code for the statement at txtptr
+ */
+static vmcode_t *
+vm_lookup(offset)
+unsigned int offset;
+{
+    vmcode_t *code;
+    unsigned char *save;
+    unsigned int eol;
+    int h;
+
+    h = offset % VM_HASH;
+    for (code = vm_table[h]; code != NULL; code = code->next) {
+        if (code->offset == offset) {
+            code->used = 1;
+            return code;
+        }
+    }
+
+    /* Make room by dropping statements that are no longer running */
+    if (vm_bytes > VM_CACHE) {
+        vm_evict();
+    }
+
+    code = (vmcode_t *)malloc(sizeof(vmcode_t));
+    if (!code) {
+        return NULL;
+    }
+    code->size = sizeof(vmcode_t);
+    code->used = 0;
+
+    /* End of line, for IF and REM */
+    eol = (unsigned int)(line_end() - g_state->txttab);
+
+    save = g_state->txtptr;
+    ccount = 0;
+    cdepth = 0;
+    cfail = 0;
+
+    code->offset = offset;
+    code->end = compile_statement(eol);
+    code->insn = NULL;
+#if HAVE_JIT
+    code->runs = 0;
+    code->native = NULL;
+#endif
+
+    g_state->txtptr = save;
+
+    if (!cfail) {
+        emit(OP_HALT, 0, 0);
+        code->insn = (vminsn_t *)malloc(ccount * sizeof(vminsn_t));
+        if (code->insn) {
+            memcpy(code->insn, cbuf, ccount * sizeof(vminsn_t));
+            code->size += ccount * sizeof(vminsn_t);
+        }
+    }
+    vm_bytes += code->size;
+
+    code->next = vm_table[h];
+    vm_table[h] = code;
+    return code;
+}
+
+/*
+ * Transfer control to a line
+ */
+static void
+vm_jump(line)
+line_t *line;
+{
+    if (!line) {
+        error(ERR_UNDEF_STMT);
+        return;
+    }
+
+    g_state->curlin = line->linenum;
+    g_state->txtptr = line->text;
+    g_state->curline_ptr = line;
+}
+
+/*
+ * Push GOSUB return address and transfer control
+ * Stack space has already been checked by OP_GOSCHK.
+ */
+static void
+vm_call(line)
+line_t *line;
+{
+    if (!line) {
+        error(ERR_UNDEF_STMT);
+        return;
+    }
+
+    g_state->gosubstack[g_state->gosubsp].linenum = g_state->curlin;
+    g_state->gosubstack[g_state->gosubsp].txtptr = g_state->txtptr;
+    g_state->gosubstack[g_state->gosubsp].line_ptr = g_state->curline_ptr;
+    g_state->gosubsp++;
+
+    vm_jump(line);
+}
+
+/*
+ * Take the n-th branch of an OP_ON/OP_ONGOSUB table
+ * As in do_on(), below 1 takes the first line and past the end falls
+ * through to the next statement.
+ */
+static void
+vm_on(ip, n)
+vminsn_t *ip;
+int n;
+{
+    line_t *line;
+
+    if (n > ip->arg) {
+        return;
+    }
+    line = ip[n < 1 ? 1 : n].u.line;
+
+    if (ip->op == OP_ONGOSUB) {
+        if (line && g_state->gosubsp >= 26) {
+            error(ERR_OUT_OF_MEM);
+            return;
+        }
+        vm_call(line);
+    } else {
+        vm_jump(line);
+    }
+}
+
+/*
+ * Call a numeric function by token
+ */
+double
+vm_fn(token, x)
+int token;
+double x;
+{
+    switch (token) {
+        case TOK_SGN:   return fn_sgn(x);
+        case TOK_INT:   return fn_int(x);
+        case TOK_ABS:   return fn_abs(x);
+        case TOK_SQR:   return fn_sqr(x);
+        case TOK_RND:   return fn_rnd(x);
+        case TOK_SIN:   return fn_sin(x);
+        case TOK_COS:   return fn_cos(x);
+        case TOK_TAN:   return fn_tan(x);
+        case TOK_ATN:   return fn_atn(x);
+        case TOK_LOG:   return fn_log(x);
+        case TOK_EXP:   return fn_exp(x);
+        case TOK_PEEK:  return fn_peek(x);
+        case TOK_FRE:   return fn_fre(x);
+        case TOK_POS:   return fn_pos(x);
+    }
+    return 0.0;
+}
+
+/*
+ * Pop subscripts into indices - arg is as c_subscripts() returned it
+ */
+vmcell_t *
+vm_indices(sp, arg, indices)
+vmcell_t *sp;
+int arg;
+int *indices;
+{
+    int i, n;
+    long v;
+
+    n = SUB_COUNT(arg);
+    sp -= n;
+    for (i = 0; i < n; i++) {
+        if (SUB_INT(arg, i)) {
+            v = sp[i].i;
+            indices[i] = (v < 0 || v > 32767L) ? -1 : (int)v;
+        } else {
+            indices[i] = (int)sp[i].num;
+        }
+    }
+    return sp;
+}
+
+/*
+ * Execute compiled code
+ */
+static void
+vm_run(code)
+vmcode_t *code;
+{
+    vmcell_t stack[VM_STACK];
+    int indices[11];
+    vmcell_t *sp;
+    double *addr;
+    short *iaddr;
+    double *varptr;
+    vminsn_t *ip;
+    forstack_t *fp;
+    short *ielem;
+    double current;
+    int i;
+#if VM_THREADED
+    static void *vm_labels[] = {
+        &&L_OP_HALT, &&L_OP_NUM, &&L_OP_VAR, &&L_OP_ARR, &&L_OP_NEG,
+        &&L_OP_NOT, &&L_OP_ADD, &&L_OP_SUB, &&L_OP_MUL, &&L_OP_DIV,
+        &&L_OP_POW, &&L_OP_REL, &&L_OP_AND, &&L_OP_OR, &&L_OP_FN,
+        &&L_OP_LET, &&L_OP_ELEM, &&L_OP_STORE, &&L_OP_GOTO, &&L_OP_GOTOX,
+        &&L_OP_GOSUB, &&L_OP_GOSUBX, &&L_OP_GOSCHK, &&L_OP_RETURN,
+        &&L_OP_FORCHK, &&L_OP_FOR, &&L_OP_NEXT, &&L_OP_IF, &&L_OP_THEN,
+        &&L_OP_END, &&L_OP_INUM, &&L_OP_IVAR, &&L_OP_IARR, &&L_OP_FLT,
+        &&L_OP_FLT2, &&L_OP_CINT, &&L_OP_IADD, &&L_OP_ISUB, &&L_OP_IMUL,
+        &&L_OP_INEG, &&L_OP_IREL, &&L_OP_INOT, &&L_OP_IAND, &&L_OP_IOR,
+        &&L_OP_ILET, &&L_OP_IELEM, &&L_OP_ISTORE, &&L_OP_IIF, &&L_OP_PRNUM,
+        &&L_OP_PRSTR, &&L_OP_PRCOMMA, &&L_OP_PRTAB, &&L_OP_PRNL, &&L_OP_ON,
+        &&L_OP_ONGOSUB
+    };
+#endif
+
+    g_state->txtptr = g_state->txttab + code->end;
+    sp = stack;
+    addr = NULL;
+    iaddr = NULL;
+
+    for (ip = code->insn; ; ip++) {
+        VM_DISPATCH;
+        switch (ip->op) {
+            VM_CASE(OP_HALT):
+                return;
+
+            VM_CASE(OP_NUM):
+                (sp++)->num = ip->u.num;
+                VM_NEXT;
+
+            VM_CASE(OP_VAR):
+                (sp++)->num = ip->u.var->value.numval;
+                VM_NEXT;
+
+            VM_CASE(OP_ARR):
+                sp = vm_indices(sp, ip->arg, indices);
+                addr = array_num_at(slot_array(ip->u.slot, 1), indices,
+                                    SUB_COUNT(ip->arg));
+                (sp++)->num = addr ? *addr : 0.0;
+                VM_NEXT;
+
+            VM_CASE(OP_NEG):
+                sp[-1].num = -sp[-1].num;
+                VM_NEXT;
+
+            VM_CASE(OP_NOT):
+                sp[-1].num = (sp[-1].num == 0.0) ? -1.0 : 0.0;
+                VM_NEXT;
+
+            VM_CASE(OP_ADD):
+                sp--;
+                sp[-1].num = sp[-1].num + sp[0].num;
+                VM_NEXT;
+
+            VM_CASE(OP_SUB):
+                sp--;
+                sp[-1].num = sp[-1].num - sp[0].num;
+                VM_NEXT;
+
+            VM_CASE(OP_MUL):
+                sp--;
+                sp[-1].num = sp[-1].num * sp[0].num;
+                VM_NEXT;
+
+            VM_CASE(OP_DIV):
+                sp--;
+                if (sp[0].num == 0.0) {
+                    error(ERR_DIV_ZERO);
+                    return;
+                }
+                sp[-1].num = sp[-1].num / sp[0].num;
+                VM_NEXT;
+
+            VM_CASE(OP_POW):
+                sp--;
+                sp[-1].num = pow(sp[-1].num, sp[0].num);
+                VM_NEXT;
+
+            VM_CASE(OP_REL):
+                sp--;
+                switch (ip->arg) {
+                    case 1: i = sp[-1].num < sp[0].num; break;
+                    case 2: i = sp[-1].num > sp[0].num; break;
+                    case 3: i = sp[-1].num <= sp[0].num; break;
+                    case 4: i = sp[-1].num >= sp[0].num; break;
+                    case 5: i = sp[-1].num != sp[0].num; break;
+                    default: i = sp[-1].num == sp[0].num; break;
+                }
+                sp[-1].num = i ? -1.0 : 0.0;
+                VM_NEXT;
+
+            VM_CASE(OP_AND):
+                sp--;
+                sp[-1].num = (double)((long)sp[-1].num & (long)sp[0].num);
+                VM_NEXT;
+
+            VM_CASE(OP_OR):
+                sp--;
+                sp[-1].num = (double)((long)sp[-1].num | (long)sp[0].num);
+                VM_NEXT;
+
+            VM_CASE(OP_FN):
+                sp[-1].num = vm_fn(ip->arg, sp[-1].num);
+                VM_NEXT;
+
+            VM_CASE(OP_LET):
+                ip->u.var->value.numval = (--sp)->num;
+                VM_NEXT;
+
+            VM_CASE(OP_ELEM):
+                sp = vm_indices(sp, ip->arg, indices);
+                addr = array_num_at(slot_array(ip->u.slot, 1), indices,
+                                    SUB_COUNT(ip->arg));
+                VM_NEXT;
+
+            VM_CASE(OP_STORE):
+                sp--;
+                if (addr) *addr = sp->num;
+                VM_NEXT;
+
+            VM_CASE(OP_GOTO):
+                vm_jump(ip->u.line);
+                VM_NEXT;
+
+            VM_CASE(OP_GOTOX):
+                vm_jump(find_line((int)(--sp)->num));
+                VM_NEXT;
+
+            VM_CASE(OP_GOSCHK):
+                if (g_state->gosubsp >= 26) {
+                    error(ERR_OUT_OF_MEM);
+                    return;
+                }
+                VM_NEXT;
+
+            VM_CASE(OP_GOSUB):
+                vm_call(ip->u.line);
+                VM_NEXT;
+
+            VM_CASE(OP_GOSUBX):
+                vm_call(find_line((int)(--sp)->num));
+                VM_NEXT;
+
+            VM_CASE(OP_RETURN):
+                do_return();
+                VM_NEXT;
+
+            VM_CASE(OP_FORCHK):
+                if (g_state->forsp >= 26) {
+                    error(ERR_OUT_OF_MEM);
+                    return;
+                }
+                VM_NEXT;
+
+            VM_CASE(OP_FOR):
+                sp -= 2;
+                fp = &g_state->forstack[g_state->forsp++];
+                fp->linenum = g_state->curlin;
+                fp->txtptr = g_state->txtptr;
+                fp->line_ptr = g_state->curline_ptr;
+                fp->varptr = &ip->u.var->value.numval;
+                fp->limit = sp[0].num;
+                fp->step = sp[1].num;
+                fp->down = sp[1].num < 0;
+                VM_NEXT;
+
+            VM_CASE(OP_NEXT):
+                if (g_state->forsp == 0) {
+                    error(ERR_NEXT_NO_FOR);
+                    return;
+                }
+                fp = &g_state->forstack[g_state->forsp-1];
+                varptr = ip->u.var ? &ip->u.var->value.numval : fp->varptr;
+
+                current = *varptr + fp->step;
+                *varptr = current;
+
+                if (fp->down ? current < fp->limit : current > fp->limit) {
+                    g_state->forsp--;
+                } else {
+                    g_state->curlin = fp->linenum;
+                    g_state->txtptr = fp->txtptr;
+                    g_state->curline_ptr = fp->line_ptr;
+                }
+                VM_NEXT;
+
+            VM_CASE(OP_IF):
+                if ((--sp)->num == 0.0) {
+                    g_state->txtptr = g_state->txttab + ip->arg;
+                    return;
+                }
+                VM_NEXT;
+
+            VM_CASE(OP_THEN):
+                /* Rest of the line is interpreted; code may be freed */
+                g_state->txtptr = g_state->txttab + ip->arg;
+                execute_statement();
+                while (peek_char() == ':') {
+                    get_next_char();
+                    execute_statement();
+                }
+                return;
+
+            VM_CASE(OP_END):
+                do_end();
+                VM_NEXT;
+
+            VM_CASE(OP_INUM):
+                (sp++)->i = ip->arg;
+                VM_NEXT;
+
+            VM_CASE(OP_IVAR):
+                (sp++)->i = ip->u.var->value.intval;
+                VM_NEXT;
+
+            VM_CASE(OP_IARR):
+                sp = vm_indices(sp, ip->arg, indices);
+                ielem = array_int_at(slot_array(ip->u.slot, 1), indices,
+                                     SUB_COUNT(ip->arg));
+                (sp++)->i = ielem ? *ielem : 0;
+                VM_NEXT;
+
+            VM_CASE(OP_FLT):
+                sp[-1].num = (double)sp[-1].i;
+                VM_NEXT;
+
+            VM_CASE(OP_FLT2):
+                sp[-2].num = (double)sp[-2].i;
+                VM_NEXT;
+
+            VM_CASE(OP_CINT):
+                sp[-1].i = int_value(sp[-1].num);
+                VM_NEXT;
+
+            VM_CASE(OP_IADD):
+                sp--;
+                sp[-1].i = sp[-1].i + sp[0].i;
+                VM_NEXT;
+
+            VM_CASE(OP_ISUB):
+                sp--;
+                sp[-1].i = sp[-1].i - sp[0].i;
+                VM_NEXT;
+
+            VM_CASE(OP_IMUL):
+                sp--;
+                sp[-1].i = sp[-1].i * sp[0].i;
+                VM_NEXT;
+
+            VM_CASE(OP_INEG):
+                sp[-1].i = -sp[-1].i;
+                VM_NEXT;
+
+            VM_CASE(OP_IREL):
+                sp--;
+                switch (ip->arg) {
+                    case 1: i = sp[-1].i < sp[0].i; break;
+                    case 2: i = sp[-1].i > sp[0].i; break;
+                    case 3: i = sp[-1].i <= sp[0].i; break;
+                    case 4: i = sp[-1].i >= sp[0].i; break;
+                    case 5: i = sp[-1].i != sp[0].i; break;
+                    default: i = sp[-1].i == sp[0].i; break;
+                }
+                sp[-1].i = i ? -1 : 0;
+                VM_NEXT;
+
+            VM_CASE(OP_INOT):
+                sp[-1].i = (sp[-1].i == 0) ? -1 : 0;
+                VM_NEXT;
+
+            VM_CASE(OP_IAND):
+                sp--;
+                sp[-1].i = sp[-1].i & sp[0].i;
+                VM_NEXT;
+
+            VM_CASE(OP_IOR):
+                sp--;
+                sp[-1].i = sp[-1].i | sp[0].i;
+                VM_NEXT;
+
+            VM_CASE(OP_ILET):
+                sp--;
+                if (sp->i < -32768L || sp->i > 32767L) {
+                    error(ERR_ILLEGAL_FUNC);
+                    return;
+                }
+                ip->u.var->value.intval = (short)sp->i;
+                VM_NEXT;
+
+            VM_CASE(OP_IELEM):
+                sp = vm_indices(sp, ip->arg, indices);
+                iaddr = array_int_at(slot_array(ip->u.slot, 1), indices,
+                                     SUB_COUNT(ip->arg));
+                VM_NEXT;
+
+            VM_CASE(OP_ISTORE):
+                sp--;
+                if (sp->i < -32768L || sp->i > 32767L) {
+                    error(ERR_ILLEGAL_FUNC);
+                    return;
+                }
+                if (iaddr) *iaddr = (short)sp->i;
+                VM_NEXT;
+
+            VM_CASE(OP_IIF):
+                if ((--sp)->i == 0) {
+                    g_state->txtptr = g_state->txttab + ip->arg;
+                    return;
+                }
+                VM_NEXT;
+
+            VM_CASE(OP_PRNUM):
+                out_number((--sp)->num);
+                VM_NEXT;
+
+            VM_CASE(OP_PRSTR):
+                out_text((char *)ip->u.text, ip->arg);
+                VM_NEXT;
+
+            VM_CASE(OP_PRCOMMA):
+                out_spaces(CLMWID - g_state->trmpos % CLMWID);
+                VM_NEXT;
+
+            VM_CASE(OP_PRTAB):
+                i = (int)(--sp)->num;
+                out_spaces(ip->arg ? i : i - 1 - g_state->trmpos);
+                VM_NEXT;
+
+            VM_CASE(OP_PRNL):
+                out_newline();
+                VM_NEXT;
+
+            VM_CASE(OP_ON):
+            VM_CASE(OP_ONGOSUB):
+                vm_on(ip, (int)(--sp)->num);
+                ip += ip->arg;
+                VM_NEXT;
+        }
+    }
+}
+
+/*
+ * Execute the statement at txtptr from its compiled form
+ * Returns 0 if the statement must be interpreted instead.
+ */
+int
+vm_execute()
+{
+    vmcode_t *code;
+
+    if (g_state->txtptr < g_state->txttab ||
+        g_state->txtptr >= g_state->vartab) {
+        return 0;
+    }
+
+    code = vm_lookup((unsigned int)(g_state->txtptr - g_state->txttab));
+    if (!code || !code->insn) {
+        return 0;
+    }
+
+#if HAVE_JIT
+    if (code->native) {
+        g_state->txtptr = g_state->txttab + code->end;
+        (*code->native)();
+        return 1;
+    }
+    if (++code->runs == JIT_HOT) {
+        code->native = jit_compile(code->insn);
+    }
+#endif
+
+    vm_run(code);
+    return 1;
+}
+
+#if HAVE_JIT
+/*
+ * Forget all native code, which jit.c is about to write over.  A
+ * statement that had some is translated again when it next runs.
+ */
+void
+vm_unjit()
+{
+    vmcode_t *code;
+    int i;
+
+    for (i = 0; i < VM_HASH; i++) {
+        for (code = vm_table[i]; code != NULL; code = code->next) {
+            if (code->native) {
+                code->native = NULL;
+                code->runs = JIT_HOT - 1;
+            }
+        }
+    }
+}
+#endif
+
+/*
+ * Discard all compiled code
+ */
+void
+vm_flush()
+{
+    vmcode_t *code;
+    vmcode_t *next;
+    int i;
+
+    for (i = 0; i < VM_HASH; i++) {
+        for (code = vm_table[i]; code != NULL; code = next) {
+            next = code->next;
+            vm_free(code);
+        }
+        vm_table[i] = NULL;
+    }
+    vm_bytes = 0;
+    vm_hand = 0;
+#if HAVE_JIT
+    jit_flush();
+#endif
+}